@@ -1,11 +1,30 @@
 #version 330 core
 layout(location = 0) out vec4 color;
 in vec2 v_texCoord;
+in vec2 v_position;
 uniform sampler2D u_Texture;
+uniform sampler2D u_Palette;
+uniform bool u_Indexed;
 uniform vec4 u_Color;
+uniform bool u_Lit;
+uniform sampler2D u_Light;
+uniform vec2 u_LightOrigin;
+uniform vec2 u_LightSize;
+uniform float u_Ambient;
 void main() {
-	vec4 texColor = texture(u_Texture, v_texCoord);
+	vec4 texColor;
+	if( u_Indexed ){
+		// Red channel holds the palette index
+		int index = int(texture(u_Texture, v_texCoord).r * 255.0 + 0.5);
+		texColor = texelFetch(u_Palette, ivec2(index, 0), 0);
+	} else
+		texColor = texture(u_Texture, v_texCoord);
 	if( texColor.a < 0.1 )
 		discard;
+	if( u_Lit ){
+		// One texel per tile, the map's lower-left corner at u_LightOrigin
+		float light = texture(u_Light, (v_position - u_LightOrigin) / u_LightSize).r;
+		texColor.rgb *= max(light, u_Ambient);
+	}
 	color = texColor;
 };
@@ -2,7 +2,9 @@
 layout(location = 0) in vec4 position;
 layout(location = 1) in vec2 texCoords;
 out vec2 v_texCoord;
+out vec2 v_position;
 void main() {
 	gl_Position = position;
 	v_texCoord = texCoords;
+	v_position = position.xy;
 };
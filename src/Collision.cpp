@@ -0,0 +1,655 @@
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLLISION_X86
+#endif
+
+#include "Engine.h"
+#include "Collision.h"
+
+
+namespace Engine {
+
+// ============== AABB METHODS
+
+AABB::AABB(){
+	x0 = 0; y0 = 0; x1 = 0; y1 = 0;
+}
+
+AABB::AABB(float x0, float y0, float x1, float y1){
+	this->x0 = x0; this->y0 = y0;
+	this->x1 = x1; this->y1 = y1;
+}
+
+AABB AABB::FromVertices(const float* vertices){
+	return AABB(vertices[V1_X], vertices[V1_Y], vertices[V2_X], vertices[V4_Y]);
+}
+
+// Intervals overlap on both axes
+bool AABB::Overlaps(const AABB& other) const {
+	return x0 < other.x1 and other.x0 < x1 and y0 < other.y1 and other.y0 < y1;
+}
+
+
+// ============== AABB LIST METHODS
+
+AABBList::AABBList(): x0(), y0(), x1(), y1() {}
+
+void AABBList::Add(const AABB& box){
+	x0.push_back(box.x0); y0.push_back(box.y0);
+	x1.push_back(box.x1); y1.push_back(box.y1);
+}
+
+void AABBList::Clear(){
+	x0.clear(); y0.clear(); x1.clear(); y1.clear();
+}
+
+int AABBList::Size(){
+	return int(x0.size());
+}
+
+
+// ============== BATCH OVERLAP KERNELS
+
+static int OverlapScalar(const AABB& b, AABBList& list, int start, unsigned char* hits){
+	int count = 0;
+	for(int i=start; i<list.Size(); ++i){
+		bool hit = b.x0 < list.x1[i] and list.x0[i] < b.x1 and b.y0 < list.y1[i] and list.y0[i] < b.y1;
+		if(hits) hits[i] = hit;
+		count += hit;
+	}
+	return count;
+}
+
+#ifdef COLLISION_X86
+
+__attribute__((target("sse2")))
+static int OverlapSSE(const AABB& b, AABBList& list, unsigned char* hits){
+	const __m128 bx0 = _mm_set1_ps(b.x0), by0 = _mm_set1_ps(b.y0);
+	const __m128 bx1 = _mm_set1_ps(b.x1), by1 = _mm_set1_ps(b.y1);
+	int n = list.Size(), count = 0, i = 0;
+	for(; i + 4 <= n; i += 4){
+		__m128 hit = _mm_and_ps(
+			_mm_and_ps(_mm_cmplt_ps(bx0, _mm_loadu_ps(&list.x1[i])), _mm_cmplt_ps(_mm_loadu_ps(&list.x0[i]), bx1)),
+			_mm_and_ps(_mm_cmplt_ps(by0, _mm_loadu_ps(&list.y1[i])), _mm_cmplt_ps(_mm_loadu_ps(&list.y0[i]), by1)));
+		int mask = _mm_movemask_ps(hit);
+		if(hits) for(int j=0; j!=4; ++j) hits[i+j] = (mask >> j) & 1;
+		count += __builtin_popcount(mask);
+	}
+	return count + OverlapScalar(b, list, i, hits);
+}
+
+__attribute__((target("avx")))
+static int OverlapAVX(const AABB& b, AABBList& list, unsigned char* hits){
+	const __m256 bx0 = _mm256_set1_ps(b.x0), by0 = _mm256_set1_ps(b.y0);
+	const __m256 bx1 = _mm256_set1_ps(b.x1), by1 = _mm256_set1_ps(b.y1);
+	int n = list.Size(), count = 0, i = 0;
+	for(; i + 8 <= n; i += 8){
+		__m256 hit = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(bx0, _mm256_loadu_ps(&list.x1[i]), _CMP_LT_OQ),
+			              _mm256_cmp_ps(_mm256_loadu_ps(&list.x0[i]), bx1, _CMP_LT_OQ)),
+			_mm256_and_ps(_mm256_cmp_ps(by0, _mm256_loadu_ps(&list.y1[i]), _CMP_LT_OQ),
+			              _mm256_cmp_ps(_mm256_loadu_ps(&list.y0[i]), by1, _CMP_LT_OQ)));
+		int mask = _mm256_movemask_ps(hit);
+		if(hits) for(int j=0; j!=8; ++j) hits[i+j] = (mask >> j) & 1;
+		count += __builtin_popcount(mask);
+	}
+	return count + OverlapScalar(b, list, i, hits);
+}
+
+#endif // COLLISION_X86
+
+static bool OverlapSupported(OverlapKernel kernel){
+#ifdef COLLISION_X86
+	if(kernel == OVERLAP_AVX) return __builtin_cpu_supports("avx");
+	if(kernel == OVERLAP_SSE) return __builtin_cpu_supports("sse2");
+#endif
+	return kernel == OVERLAP_SCALAR;
+}
+
+static OverlapKernel BestOverlapKernel(){
+	if(OverlapSupported(OVERLAP_AVX)) return OVERLAP_AVX;
+	if(OverlapSupported(OVERLAP_SSE)) return OVERLAP_SSE;
+	return OVERLAP_SCALAR;
+}
+
+OverlapKernel OVERLAP_KERNEL = BestOverlapKernel();
+
+bool SetOverlapKernel(OverlapKernel kernel){
+	if(!OverlapSupported(kernel)) return false;
+	OVERLAP_KERNEL = kernel;
+	return true;
+}
+
+int OverlapBatch(const AABB& box, AABBList& list, unsigned char* hits){
+	switch(OVERLAP_KERNEL){
+#ifdef COLLISION_X86
+		case OVERLAP_AVX: return OverlapAVX(box, list, hits);
+		case OVERLAP_SSE: return OverlapSSE(box, list, hits);
+#endif
+		default: return OverlapScalar(box, list, 0, hits);
+	}
+}
+
+
+// ============== GRID QUERIES
+
+bool GridCellRange(Tilemap& tmap, float x0, float y0, float x1, float y1, int& col0, int& row0, int& col1, int& row1){
+	float ox = tmap.origin_x, oy = tmap.origin_y;
+	float tw = tmap.tile_w, th = tmap.tile_h;
+
+	// Open intervals: a box edge lying on a cell boundary does not reach into it
+	col0 = int(std::floor((x0 - ox) / tw));
+	row0 = int(std::floor((y0 - oy) / th));
+	col1 = int(std::ceil((x1 - ox) / tw)) - 1;
+	row1 = int(std::ceil((y1 - oy) / th)) - 1;
+
+	col0 = std::max(col0, 0); row0 = std::max(row0, 0);
+	col1 = std::min(col1, tmap.width - 1); row1 = std::min(row1, tmap.height - 1);
+	return col0 <= col1 and row0 <= row1;
+}
+
+bool GridCollides(Tilemap& tmap, float x0, float y0, float x1, float y1, int blocking){
+	int col0, row0, col1, row1;
+	if(!GridCellRange(tmap, x0, y0, x1, y1, col0, row0, col1, row1)) return false;
+	for(int r=row0; r<=row1; ++r){
+		const int* row = tmap.logic_grid + r*tmap.width;
+		for(int c=col0; c<=col1; ++c){
+			if(row[c] == blocking) return true;
+		}
+	}
+	return false;
+}
+
+bool GridCollides(Tilemap& tmap, const AABB& box, int blocking){
+	return GridCollides(tmap, box.x0, box.y0, box.x1, box.y1, blocking);
+}
+
+bool GridCollides(Tilemap& tmap, Shape& shape, int blocking){
+	return GridCollides(tmap, AABB::FromVertices(&shape.vertices[0]), blocking);
+}
+
+
+// ============== BLOCK BITMAP METHODS
+
+BlockBitmap::BlockBitmap(): bits() {
+	width = 0; height = 0; blocking = TILE_WALL; words = 0; version = 0;
+}
+
+void BlockBitmap::Init(int width, int height){
+	this->width = width;
+	this->height = height;
+	this->words = (width + 63) / 64;
+	this->bits.assign(size_t(words) * height, 0);
+	this->version++;
+}
+
+void BlockBitmap::Build(Tilemap& tmap, int blocking){
+	this->Init(tmap.width, tmap.height);
+	this->blocking = blocking;
+	for(int r=0; r!=height; ++r){
+		const int* row = tmap.logic_grid + r*width;
+		uint64_t* out = &this->bits[size_t(r) * words];
+		for(int c=0; c!=width; ++c){
+			if(row[c] == blocking) out[c >> 6] |= uint64_t(1) << (c & 63);
+		}
+	}
+}
+
+void BlockBitmap::Update(Tilemap& tmap, int cell){
+	this->Set(cell % width, cell / width, tmap.logic_grid[cell] == this->blocking);
+}
+
+bool BlockBitmap::Get(int col, int row) const {
+	return (this->bits[size_t(row) * words + (col >> 6)] >> (col & 63)) & 1;
+}
+
+void BlockBitmap::Set(int col, int row, bool blocked){
+	uint64_t& word = this->bits[size_t(row) * words + (col >> 6)];
+	uint64_t bit = uint64_t(1) << (col & 63);
+	if(bool(word & bit) == blocked) return;
+	if(blocked) word |= bit;
+	else word &= ~bit;
+	this->version++;
+}
+
+// Bits col0..col1 of word 'w' of a row, all of them for inner words
+static uint64_t SpanMask(int w, int col0, int col1){
+	uint64_t mask = ~uint64_t(0);
+	if(w == (col0 >> 6)) mask &= ~uint64_t(0) << (col0 & 63);
+	if(w == (col1 >> 6)) mask &= ~uint64_t(0) >> (63 - (col1 & 63));
+	return mask;
+}
+
+bool BlockBitmap::Any(int col0, int row0, int col1, int row1) const {
+	for(int r=row0; r<=row1; ++r){
+		const uint64_t* row = &this->bits[size_t(r) * words];
+		for(int w=col0 >> 6; w<=(col1 >> 6); ++w){
+			if(row[w] & SpanMask(w, col0, col1)) return true;
+		}
+	}
+	return false;
+}
+
+int BlockBitmap::Count(int col0, int row0, int col1, int row1) const {
+	int count = 0;
+	for(int r=row0; r<=row1; ++r){
+		const uint64_t* row = &this->bits[size_t(r) * words];
+		for(int w=col0 >> 6; w<=(col1 >> 6); ++w){
+			count += __builtin_popcountll(row[w] & SpanMask(w, col0, col1));
+		}
+	}
+	return count;
+}
+
+int BlockBitmap::FirstInRow(int row, int col0, int col1) const {
+	const uint64_t* bits = &this->bits[size_t(row) * words];
+	for(int w=col0 >> 6; w<=(col1 >> 6); ++w){
+		uint64_t word = bits[w] & SpanMask(w, col0, col1);
+		if(word) return w*64 + __builtin_ctzll(word);
+	}
+	return -1;
+}
+
+bool GridCollides(Tilemap& tmap, BlockBitmap& blocked, const AABB& box){
+	int col0, row0, col1, row1;
+	if(!GridCellRange(tmap, box.x0, box.y0, box.x1, box.y1, col0, row0, col1, row1)) return false;
+	return blocked.Any(col0, row0, col1, row1);
+}
+
+
+// ============== SWEPT QUERIES
+
+SweepHit::SweepHit(){
+	hit = false; time = 1; nx = 0; ny = 0; cell = -1;
+}
+
+// Cells spanned by [lo, hi] just after time t when moving at speed v.
+// Open interval, plus the next cell if an edge sits on its boundary.
+static void SpanAfter(float lo, float hi, float v, int size, int& first, int& last){
+	first = int(std::floor(lo));
+	last = int(std::ceil(hi)) - 1;
+	if(v < 0 and float(first) == lo) first--;
+	if(v > 0 and float(last + 1) == hi) last++;
+	first = std::max(first, 0);
+	last = std::min(last, size - 1);
+}
+
+// Shared by the logic_grid and bitmap versions: blocked(col, row)
+template<typename Blocked>
+static SweepHit Sweep(Tilemap& tmap, const AABB& box, float dx, float dy, Blocked blocked){
+	SweepHit result;
+	const float inf = 1e30f;
+
+	// Work in grid units, one cell per unit
+	float x0 = (box.x0 - tmap.origin_x) / tmap.tile_w, x1 = (box.x1 - tmap.origin_x) / tmap.tile_w;
+	float y0 = (box.y0 - tmap.origin_y) / tmap.tile_h, y1 = (box.y1 - tmap.origin_y) / tmap.tile_h;
+	float vx = dx / tmap.tile_w, vy = dy / tmap.tile_h;
+
+	// Next column/row boundary the leading edge crosses, and when
+	int step_x = (vx > 0) ? 1 : -1, step_y = (vy > 0) ? 1 : -1;
+	int col = (vx > 0) ? int(std::ceil(x1)) : int(std::floor(x0)) - 1;
+	int row = (vy > 0) ? int(std::ceil(y1)) : int(std::floor(y0)) - 1;
+	float lead_x = (vx > 0) ? x1 : x0, lead_y = (vy > 0) ? y1 : y0;
+	auto cross_x = [&]{ return (vx == 0) ? inf : (float(vx > 0 ? col : col + 1) - lead_x) / vx; };
+	auto cross_y = [&]{ return (vy == 0) ? inf : (float(vy > 0 ? row : row + 1) - lead_y) / vy; };
+	float tx = cross_x(), ty = cross_y();
+
+	while(tx <= 1 or ty <= 1){
+		bool along_x = tx <= ty;
+		float t = along_x ? tx : ty;
+		int first, last;
+		if(along_x){
+			// Entering column 'col': test the rows the box spans then
+			SpanAfter(y0 + vy*t, y1 + vy*t, vy, tmap.height, first, last);
+			if(col < 0 or col >= tmap.width) first = last + 1; // Off the map, nothing to hit
+			for(int r=first; r<=last; ++r){
+				if(!blocked(col, r)) continue;
+				result.hit = true; result.time = t; result.nx = float(-step_x); result.cell = r*tmap.width + col;
+				return result;
+			}
+			col += step_x;
+			tx = cross_x();
+		}
+		else{
+			SpanAfter(x0 + vx*t, x1 + vx*t, vx, tmap.width, first, last);
+			if(row < 0 or row >= tmap.height) first = last + 1;
+			for(int c=first; c<=last; ++c){
+				if(!blocked(c, row)) continue;
+				result.hit = true; result.time = t; result.ny = float(-step_y); result.cell = row*tmap.width + c;
+				return result;
+			}
+			row += step_y;
+			ty = cross_y();
+		}
+	}
+	return result;
+}
+
+SweepHit GridSweep(Tilemap& tmap, const AABB& box, float dx, float dy, int blocking){
+	return Sweep(tmap, box, dx, dy, [&](int c, int r){ return tmap.logic_grid[r*tmap.width + c] == blocking; });
+}
+
+SweepHit GridSweep(Tilemap& tmap, BlockBitmap& blocked, const AABB& box, float dx, float dy){
+	return Sweep(tmap, box, dx, dy, [&](int c, int r){ return blocked.Get(c, r); });
+}
+
+// 'sweep' is called as sweep(box, dx, dy)
+template<typename SweepFn>
+static bool Slide(Tilemap& tmap, const AABB& box, float& dx, float& dy, SweepFn sweep){
+	// Stop this far short of a wall, in tiles, so rounding never lands inside it
+	const float skin = 1e-3f;
+	AABB moved = box;
+	float rx = dx, ry = dy; // Motion left to do
+	bool clipped = false;
+
+	// A second pass slides along the remaining axis, a third would add nothing
+	for(int pass=0; pass!=2 and (rx != 0 or ry != 0); ++pass){
+		SweepHit hit = sweep(moved, rx, ry);
+		float len = std::sqrt((rx/tmap.tile_w)*(rx/tmap.tile_w) + (ry/tmap.tile_h)*(ry/tmap.tile_h));
+		float t = hit.hit ? std::max(0.0f, hit.time - skin / len) : 1.0f;
+		moved.x0 += rx*t; moved.x1 += rx*t;
+		moved.y0 += ry*t; moved.y1 += ry*t;
+		if(!hit.hit) break;
+
+		clipped = true;
+		rx *= 1 - t; ry *= 1 - t;
+		if(hit.nx != 0) rx = 0;
+		if(hit.ny != 0) ry = 0;
+	}
+
+	dx = moved.x0 - box.x0;
+	dy = moved.y0 - box.y0;
+	return clipped;
+}
+
+bool GridSlide(Tilemap& tmap, const AABB& box, float& dx, float& dy, int blocking){
+	return Slide(tmap, box, dx, dy, [&](const AABB& b, float mx, float my){ return GridSweep(tmap, b, mx, my, blocking); });
+}
+
+bool GridSlide(Tilemap& tmap, BlockBitmap& blocked, const AABB& box, float& dx, float& dy){
+	return Slide(tmap, box, dx, dy, [&](const AABB& b, float mx, float my){ return GridSweep(tmap, blocked, b, mx, my); });
+}
+
+
+// ============== SPATIAL HASH METHODS
+
+SpatialHash::SpatialHash(): boxes(), starts(), entries(), unsorted(), unsorted_buckets() {
+	cell_size = 0.1f; bucket_num = 0;
+}
+
+void SpatialHash::Init(float cell_size){
+	this->cell_size = cell_size;
+	this->Clear();
+}
+
+int SpatialHash::Insert(const AABB& box){
+	this->boxes.Add(box);
+	return this->boxes.Size() - 1;
+}
+
+int SpatialHash::Insert(Shape& shape){
+	return this->Insert(AABB::FromVertices(&shape.vertices[0]));
+}
+
+void SpatialHash::Set(int id, const AABB& box){
+	this->boxes.x0[id] = box.x0; this->boxes.y0[id] = box.y0;
+	this->boxes.x1[id] = box.x1; this->boxes.y1[id] = box.y1;
+}
+
+void SpatialHash::Clear(){
+	this->boxes.Clear();
+	this->entries.clear();
+	this->starts.clear();
+}
+
+// Multiplicative hash, keeping the well mixed high bits
+static int CellHash(int cx, int cy, int bucket_bits){
+	uint32_t h = uint32_t(cx) * 0x9E3779B1u + uint32_t(cy) * 0x85EBCA77u;
+	return int(h >> (32 - bucket_bits));
+}
+
+// Counting sort of every (entity, cell) pair by bucket
+void SpatialHash::Build(){
+	int n = this->boxes.Size();
+	float inv = 1.0f / this->cell_size;
+	int bucket_bits = 6;
+	while((1 << bucket_bits) < 2*n) bucket_bits++;
+	this->bucket_num = 1 << bucket_bits;
+
+	std::vector<Entry>& unsorted = this->unsorted;
+	std::vector<int>& buckets = this->unsorted_buckets;
+	unsorted.clear(); buckets.clear();
+	this->starts.assign(this->bucket_num + 1, 0);
+	for(int id=0; id!=n; ++id){
+		AABB box(this->boxes.x0[id], this->boxes.y0[id], this->boxes.x1[id], this->boxes.y1[id]);
+		int cx0 = int(std::floor(this->boxes.x0[id] * inv)), cx1 = int(std::floor(this->boxes.x1[id] * inv));
+		int cy0 = int(std::floor(this->boxes.y0[id] * inv)), cy1 = int(std::floor(this->boxes.y1[id] * inv));
+		for(int cy=cy0; cy<=cy1; ++cy){
+			for(int cx=cx0; cx<=cx1; ++cx){
+				int b = CellHash(cx, cy, bucket_bits);
+				unsorted.push_back({id, cx, cy, box});
+				buckets.push_back(b);
+				this->starts[b + 1]++;
+			}
+		}
+	}
+
+	for(int b=0; b!=this->bucket_num; ++b) this->starts[b + 1] += this->starts[b];
+	this->entries.resize(unsorted.size());
+	std::vector<int> next(this->starts.begin(), this->starts.end() - 1);
+	for(size_t i=0; i!=unsorted.size(); ++i) this->entries[next[buckets[i]]++] = unsorted[i];
+}
+
+void SpatialHash::Scan(std::vector<std::pair<int,int>>& pairs, bool narrow){
+	pairs.clear();
+	float inv = 1.0f / this->cell_size;
+	for(int bucket=0; bucket!=this->bucket_num; ++bucket){
+		for(int i=this->starts[bucket]; i<this->starts[bucket + 1]; ++i){
+			const Entry& e = this->entries[i];
+			for(int j=i+1; j<this->starts[bucket + 1]; ++j){
+				const Entry& f = this->entries[j];
+				if(e.cx != f.cx or e.cy != f.cy) continue; // Other cell, same bucket
+				if(narrow and !e.box.Overlaps(f.box)) continue;
+				// Pairs sharing several cells are reported from the one
+				// holding the lower-left corner of their intersection
+				if(int(std::floor(std::max(e.box.x0, f.box.x0) * inv)) != e.cx) continue;
+				if(int(std::floor(std::max(e.box.y0, f.box.y0) * inv)) != e.cy) continue;
+				pairs.push_back(std::make_pair(std::min(e.id, f.id), std::max(e.id, f.id)));
+			}
+		}
+	}
+}
+
+void SpatialHash::Candidates(std::vector<std::pair<int,int>>& pairs){
+	this->Scan(pairs, false);
+}
+
+void SpatialHash::Collisions(std::vector<std::pair<int,int>>& pairs){
+	this->Scan(pairs, true);
+}
+
+
+// ============== WALL MESH METHODS
+
+WallMesh::WallMesh(): rects(), owner(), boxes(), candidates() {
+	width = 0; height = 0; blocking = TILE_WALL;
+}
+
+void WallMesh::Build(Tilemap& tmap, int blocking){
+	this->width = tmap.width;
+	this->height = tmap.height;
+	this->blocking = blocking;
+	this->rects.clear();
+	this->boxes.Clear();
+	this->owner.assign(width*height, -1);
+
+	std::vector<int> cells(width*height);
+	for(int i=0; i!=width*height; ++i) cells[i] = i;
+	this->Mesh(tmap, cells);
+}
+
+// Greedily covers the unowned blocking cells among 'cells': each rectangle
+// grows right as far as it can, then up while the whole row is free.
+void WallMesh::Mesh(Tilemap& tmap, std::vector<int>& cells){
+	std::sort(cells.begin(), cells.end());
+	auto free = [&](int i){ return tmap.logic_grid[i] == this->blocking and this->owner[i] == -1; };
+
+	for(int cell : cells){
+		if(!free(cell)) continue;
+		int col = cell % width, row = cell / width;
+		int w = 1, h = 1;
+		while(col + w < width and free(cell + w)) w++;
+		for(bool grow = true; grow and row + h < height; ){
+			for(int c=col; c!=col+w; ++c) if(!free((row + h)*width + c)) grow = false;
+			if(grow) h++;
+		}
+
+		int index = int(this->rects.size());
+		this->rects.push_back({col, row, w, h});
+		this->boxes.Add(AABB(float(col), float(row), float(col + w), float(row + h)));
+		for(int r=row; r!=row+h; ++r)
+			for(int c=col; c!=col+w; ++c) this->owner[r*width + c] = index;
+	}
+}
+
+// Drops a rectangle, appending its cells to 'freed'. The last rectangle
+// takes its index.
+void WallMesh::Remove(int rect, std::vector<int>& freed){
+	WallRect& wr = this->rects[rect];
+	for(int r=wr.row; r!=wr.row+wr.h; ++r){
+		for(int c=wr.col; c!=wr.col+wr.w; ++c){
+			this->owner[r*width + c] = -1;
+			freed.push_back(r*width + c);
+		}
+	}
+
+	int last = int(this->rects.size()) - 1;
+	if(rect != last){
+		WallRect& moved = this->rects[last];
+		for(int r=moved.row; r!=moved.row+moved.h; ++r)
+			for(int c=moved.col; c!=moved.col+moved.w; ++c) this->owner[r*width + c] = rect;
+		this->rects[rect] = moved;
+		this->boxes.x0[rect] = this->boxes.x0[last]; this->boxes.y0[rect] = this->boxes.y0[last];
+		this->boxes.x1[rect] = this->boxes.x1[last]; this->boxes.y1[rect] = this->boxes.y1[last];
+	}
+	this->rects.pop_back();
+	this->boxes.x0.pop_back(); this->boxes.y0.pop_back();
+	this->boxes.x1.pop_back(); this->boxes.y1.pop_back();
+}
+
+// Dissolves the rectangles at and around the cell and re-meshes their cells
+void WallMesh::Update(Tilemap& tmap, int cell){
+	std::vector<int> freed;
+	int col = cell % width, row = cell / width;
+	int around[5] = {
+		cell,
+		col > 0 ? cell - 1 : -1, col < width-1 ? cell + 1 : -1,
+		row > 0 ? cell - width : -1, row < height-1 ? cell + width : -1
+	};
+	// Neighbours only matter if the cell became blocking and may join them
+	int checks = (tmap.logic_grid[cell] == this->blocking) ? 5 : 1;
+	for(int i=0; i!=checks; ++i){
+		if(around[i] >= 0 and this->owner[around[i]] != -1) this->Remove(this->owner[around[i]], freed);
+	}
+	freed.push_back(cell);
+	this->Mesh(tmap, freed);
+}
+
+AABB WallMesh::Bounds(Tilemap& tmap, int rect){
+	WallRect& wr = this->rects[rect];
+	return AABB(tmap.origin_x + wr.col*tmap.tile_w, tmap.origin_y + wr.row*tmap.tile_h,
+	            tmap.origin_x + (wr.col + wr.w)*tmap.tile_w, tmap.origin_y + (wr.row + wr.h)*tmap.tile_h);
+}
+
+// Tests the box, taken to grid units, against every rectangle at once
+bool WallMesh::Collides(Tilemap& tmap, const AABB& box){
+	AABB grid((box.x0 - tmap.origin_x) / tmap.tile_w, (box.y0 - tmap.origin_y) / tmap.tile_h,
+	          (box.x1 - tmap.origin_x) / tmap.tile_w, (box.y1 - tmap.origin_y) / tmap.tile_h);
+	return OverlapBatch(grid, this->boxes) > 0;
+}
+
+SweepHit GridSweep(Tilemap& tmap, WallMesh& walls, const AABB& box, float dx, float dy){
+	SweepHit result;
+	const float inf = 1e30f;
+	if(walls.rects.empty()) return result;
+
+	// Grid units, like the rectangles
+	float x0 = (box.x0 - tmap.origin_x) / tmap.tile_w, x1 = (box.x1 - tmap.origin_x) / tmap.tile_w;
+	float y0 = (box.y0 - tmap.origin_y) / tmap.tile_h, y1 = (box.y1 - tmap.origin_y) / tmap.tile_h;
+	float vx = dx / tmap.tile_w, vy = dy / tmap.tile_h;
+
+	// Candidates: rectangles owning a cell of the area swept by the box
+	int col0 = std::max(int(std::floor(std::min(x0, x0 + vx))), 0);
+	int row0 = std::max(int(std::floor(std::min(y0, y0 + vy))), 0);
+	int col1 = std::min(int(std::ceil(std::max(x1, x1 + vx))) - 1, walls.width - 1);
+	int row1 = std::min(int(std::ceil(std::max(y1, y1 + vy))) - 1, walls.height - 1);
+	walls.candidates.clear();
+	for(int r=row0; r<=row1; ++r){
+		for(int c=col0; c<=col1; ++c){
+			int rect = walls.owner[r*walls.width + c];
+			if(rect == -1) continue;
+			if(std::find(walls.candidates.begin(), walls.candidates.end(), rect) == walls.candidates.end()) walls.candidates.push_back(rect);
+		}
+	}
+
+	// Time the box starts and stops overlapping [lo, hi] along one axis
+	auto slab = [&](float b0, float b1, float v, float lo, float hi, float& enter, float& exit){
+		if(v == 0){
+			bool inside = b1 > lo and b0 < hi;
+			enter = inside ? -inf : inf;
+			exit = inside ? inf : -inf;
+			return;
+		}
+		enter = ((v > 0) ? lo - b1 : hi - b0) / v;
+		exit = ((v > 0) ? hi - b0 : lo - b1) / v;
+	};
+
+	for(int rect : walls.candidates){
+		WallRect& wr = walls.rects[rect];
+		float enter_x, exit_x, enter_y, exit_y;
+		slab(x0, x1, vx, float(wr.col), float(wr.col + wr.w), enter_x, exit_x);
+		slab(y0, y1, vy, float(wr.row), float(wr.row + wr.h), enter_y, exit_y);
+		float enter = std::max(enter_x, enter_y), exit = std::min(exit_x, exit_y);
+		// Touching only, already inside, or out of reach
+		if(enter >= exit or enter < 0 or enter > 1) continue;
+		bool along_x = enter_x >= enter_y;
+		// First cell of the rectangle met, lowest along the face
+		int col, row;
+		if(along_x){
+			col = (vx > 0) ? wr.col : wr.col + wr.w - 1;
+			row = std::min(std::max(int(std::floor(y0 + vy*enter)), wr.row), wr.row + wr.h - 1);
+		} else {
+			row = (vy > 0) ? wr.row : wr.row + wr.h - 1;
+			col = std::min(std::max(int(std::floor(x0 + vx*enter)), wr.col), wr.col + wr.w - 1);
+		}
+		int cell = row*tmap.width + col;
+
+		// Ties go to the column crossing, then the lowest cell, as in the
+		// cell by cell sweep
+		if(result.hit){
+			if(enter > result.time) continue;
+			if(enter == result.time){
+				bool was_x = result.nx != 0;
+				if(was_x and !along_x) continue;
+				if(was_x == along_x and cell > result.cell) continue;
+			}
+		}
+		result.hit = true;
+		result.time = enter;
+		result.nx = along_x ? (vx > 0 ? -1.0f : 1.0f) : 0.0f;
+		result.ny = along_x ? 0.0f : (vy > 0 ? -1.0f : 1.0f);
+		result.cell = cell;
+	}
+	return result;
+}
+
+bool GridSlide(Tilemap& tmap, WallMesh& walls, const AABB& box, float& dx, float& dy){
+	return Slide(tmap, box, dx, dy, [&](const AABB& b, float mx, float my){ return GridSweep(tmap, walls, b, mx, my); });
+}
+
+} // namespace Engine
@@ -0,0 +1,172 @@
+/*
+
+	Collision queries against the tilemap grid
+
+Tiles form a regular grid, so a box only has to be tested against the cells
+it overlaps instead of every tile of the map. Boxes are given in screen
+coordinates, like Shape and Tilemap vertices, and touching edges do not
+count as overlap.
+
+*/
+
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+#include "Engine.h"
+
+namespace Engine {
+
+// Axis-aligned box. Boxes whose edges only touch do not overlap.
+struct AABB {
+	float x0, y0, x1, y1; // Min and max corners
+
+	AABB(); //Constructor
+	AABB(float x0, float y0, float x1, float y1);
+	static AABB FromVertices(const float* vertices); // Shape/tile vertex layout
+	bool Overlaps(const AABB& other) const;
+};
+
+// Boxes stored as one array per coordinate (SoA) for batch tests
+struct AABBList {
+	std::vector<float> x0, y0, x1, y1;
+
+	AABBList(); //Constructor
+	void Add(const AABB& box);
+	void Clear();
+	int Size();
+};
+
+// Batch overlap kernels, picked at startup from what the CPU supports
+enum OverlapKernel { OVERLAP_SCALAR = 0, OVERLAP_SSE, OVERLAP_AVX };
+
+extern OverlapKernel OVERLAP_KERNEL;
+
+// Forces a kernel, e.g. for benchmarking. False if the CPU lacks it.
+bool SetOverlapKernel(OverlapKernel kernel);
+
+// Tests 'box' against every box in 'list'. Returns how many overlap and,
+// if 'hits' is not null, stores 1 or 0 per list entry in it.
+int OverlapBatch(const AABB& box, AABBList& list, unsigned char* hits = nullptr);
+
+// Cells of 'tmap' overlapped by the box, clamped to the map.
+// Returns false if the box lies outside the map.
+bool GridCellRange(Tilemap& tmap, float x0, float y0, float x1, float y1, int& col0, int& row0, int& col1, int& row1);
+
+// True if the box overlaps a cell whose logic value is 'blocking'
+bool GridCollides(Tilemap& tmap, float x0, float y0, float x1, float y1, int blocking = TILE_WALL);
+bool GridCollides(Tilemap& tmap, const AABB& box, int blocking = TILE_WALL);
+bool GridCollides(Tilemap& tmap, Shape& shape, int blocking = TILE_WALL);
+
+// One bit per cell, set where logic_grid holds the blocking value. Rows
+// start on a fresh 64-bit word so region queries scan whole words.
+// A 4096x4096 map takes 2 MB instead of the 64 MB of logic_grid.
+struct BlockBitmap {
+	int width, height, blocking;
+	int words; // 64-bit words per row
+	std::vector<uint64_t> bits;
+	uint32_t version; // Bumped by every change, so users can tell their results are stale
+
+	BlockBitmap(); //Constructor
+	void Init(int width, int height); // All cells free
+	void Build(Tilemap& tmap, int blocking = TILE_WALL);
+	void Update(Tilemap& tmap, int cell); // Call after logic_grid[cell] changes
+	bool Get(int col, int row) const;
+	void Set(int col, int row, bool blocked);
+	// Regions are inclusive and must lie inside the map
+	bool Any(int col0, int row0, int col1, int row1) const;
+	int Count(int col0, int row0, int col1, int row1) const;
+	int FirstInRow(int row, int col0, int col1) const; // Column of the first blocked cell, -1 if none
+};
+
+bool GridCollides(Tilemap& tmap, BlockBitmap& blocked, const AABB& box);
+
+// First blocking cell met by a moving box
+struct SweepHit {
+	bool hit;
+	float time; // Fraction of the motion done before contact, 1 if no hit
+	float nx, ny; // Normal of the face hit, pointing back at the box
+	int cell; // Index of the cell hit, -1 if no hit
+
+	SweepHit(); //Constructor
+};
+
+// Sweeps the box by (dx,dy) through the grid, visiting only the cells its
+// leading edges enter, in order (DDA). Cells overlapped at the start are
+// ignored so a stuck box can still move out.
+SweepHit GridSweep(Tilemap& tmap, const AABB& box, float dx, float dy, int blocking = TILE_WALL);
+SweepHit GridSweep(Tilemap& tmap, BlockBitmap& blocked, const AABB& box, float dx, float dy);
+
+// Moves the box as far as it can along (dx,dy), sliding along walls it
+// meets. (dx,dy) is replaced by the motion allowed; returns true if clipped.
+bool GridSlide(Tilemap& tmap, const AABB& box, float& dx, float& dy, int blocking = TILE_WALL);
+bool GridSlide(Tilemap& tmap, BlockBitmap& blocked, const AABB& box, float& dx, float& dy);
+
+// Broadphase for moving entities: boxes are binned into a uniform grid of
+// hashed cells each tick, so only entities sharing a cell get compared.
+// Cells should be about the size of a typical entity.
+struct SpatialHash {
+	struct Entry {
+		int id, cx, cy;
+		AABB box; // Copied so a bucket scan reads memory in order
+	};
+
+	float cell_size; // Screen coordinates
+	AABBList boxes; // One per entity, indexed by id
+	int bucket_num; // Power of two, grows with the entity count
+	std::vector<int> starts; // First entry of every bucket, plus the end
+	std::vector<Entry> entries; // Entity/cell pairs sorted by bucket
+	std::vector<Entry> unsorted; // Build scratch, kept between ticks
+	std::vector<int> unsorted_buckets;
+
+	SpatialHash(); //Constructor
+	void Init(float cell_size);
+	int Insert(const AABB& box); // Returns the entity id
+	int Insert(Shape& shape);
+	void Set(int id, const AABB& box); // Entity moved
+	void Clear(); // Forget every entity
+	void Build(); // Bins the boxes, call after moving entities
+	// Entity pairs sharing a cell. Every overlapping pair comes out once.
+	void Candidates(std::vector<std::pair<int,int>>& pairs);
+	void Collisions(std::vector<std::pair<int,int>>& pairs); // Overlapping pairs only
+
+	void Scan(std::vector<std::pair<int,int>>& pairs, bool narrow);
+};
+
+// Rectangle of blocking cells, in grid units
+struct WallRect {
+	int col, row, w, h;
+};
+
+// Blocking cells of a tilemap merged into large rectangles (greedy
+// meshing), so long walls and buildings are a handful of boxes instead of
+// one per cell. Update() re-meshes only around a changed cell.
+struct WallMesh {
+	int width, height, blocking;
+	std::vector<WallRect> rects;
+	std::vector<int> owner; // Rect index per cell, -1 if not blocking
+	AABBList boxes; // 'rects' in grid units, for OverlapBatch
+	std::vector<int> candidates; // Sweep scratch: rectangles near the swept area
+
+	WallMesh(); //Constructor
+	void Build(Tilemap& tmap, int blocking = TILE_WALL);
+	void Update(Tilemap& tmap, int cell); // Call after logic_grid[cell] changes
+	AABB Bounds(Tilemap& tmap, int rect); // Screen coordinates
+	bool Collides(Tilemap& tmap, const AABB& box);
+
+	void Mesh(Tilemap& tmap, std::vector<int>& cells);
+	void Remove(int rect, std::vector<int>& freed);
+};
+
+// Sweeps against the merged rectangles instead of cell by cell: the
+// rectangles owning a cell of the swept area are gathered once each and
+// given one slab test. Rectangles overlapped at the start are ignored.
+SweepHit GridSweep(Tilemap& tmap, WallMesh& walls, const AABB& box, float dx, float dy);
+bool GridSlide(Tilemap& tmap, WallMesh& walls, const AABB& box, float& dx, float& dy);
+
+} // namespace Engine
+
+#endif // COLLISION_H
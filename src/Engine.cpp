@@ -6,6 +6,7 @@
 #include <sstream>
 #include <cmath>
 #include <chrono>
+#include <algorithm>
 
 // OpenGL
 #include <GL/glew.h>
@@ -19,6 +20,10 @@
 #include "stb_image_write.h"
 
 #include "Engine.h"
+#include "Collision.h"
+#include "Image.h"
+#include "Loader.h"
+#include "Pack.h"
 
 
 
@@ -40,43 +45,191 @@ int KEYSTATES[] =  { 0 };
 
 GLFWwindow* WINDOW = nullptr;
 
+Shader* ACTIVE_SHADER = nullptr;
+
+TextureCache TEXTURE_CACHE;
+TextureMemory TEXTURE_MEMORY;
+
 // ============== TEXTURE METHODS
 //Constructor
-Texture::Texture(): filepath() {
+TextureDesc::TextureDesc(){
+	format = GL_RGBA8;
+	mipmaps = false;
+	immutable = true;
+	indexed = false;
+	min_filter = GL_NEAREST; mag_filter = GL_NEAREST;
+	wrap_s = GL_REPEAT; wrap_t = GL_REPEAT;
+}
+
+int TextureDesc::Channels(){
+	if(this->format == GL_R8) return 1;
+	if(this->format == GL_RGB8) return 3;
+	return 4;
+}
+
+//Constructor
+Texture::Texture(): filepath(), desc() {
 	id = 0; width = 0; height = 0; channel_num = 0;
+	loaded = false;
+	immutable = false;
+	palette_id = 0;
 }
 
 void Texture::Init(std::string& fpath, int mode){
-	unsigned char *image_data;
+	TextureDesc desc;
+	if(mode == GL_RGB) desc.format = GL_RGB8;
+	this->Init(fpath, desc);
+}
+
+void Texture::Init(std::string& fpath, TextureDesc& desc){
+	Image image;
 	this->filepath = fpath;	
-	image_data = stbi_load(fpath.c_str(), &this->width, &this->height, &this->channel_num, 0);
-	if(!image_data){
+	this->desc = desc;
+
+	// Channels are expanded or stripped while decoding (or come from the
+	// disk cache), so the buffer is uploaded as is without another copy.
+	if(!image.Load(fpath, desc.indexed ? 4 : desc.Channels())){
 		std::cerr << "Error: failed to load image '" << fpath << "'" << std::endl;
 		exit(-1);
 	}
-   	
-	unsigned char rgba_data[this->height * this->width * 4];
-	if(this->channel_num == 3 and mode == GL_RGBA){
-		std::cout << "Warning: texture '" << fpath << "' will be converted to RGBA" << std::endl;
-		this->channel_num++;
-		rgba(rgba_data, image_data, this->height * this->width);
-	} else std::copy(image_data, image_data + this->height * this->width * 4, rgba_data);
-	
-	glGenTextures(1, &this->id);
+	this->UploadImage(image);
+	image.Free();
+}
+
+void Texture::UploadImage(Image& image){
+	this->width = image.width;
+	this->height = image.height;
+	this->channel_num = image.channel_num;
+
+	if(this->desc.indexed){
+		std::vector<unsigned char> indices, colors;
+		if(image.Palettize(indices, colors)){
+			this->desc.format = GL_R8;
+			this->channel_num = 1;
+			this->Upload(&indices[0]);
+			this->SetPalette(&colors[0], colors.size()/4);
+			return;
+		}
+		std::cout << "Warning: texture '" << this->filepath << "' has over 256 colours, storing as RGBA" << std::endl;
+		this->desc.indexed = false;
+	}
+	this->Upload(image.pixels);
+}
+
+// Replaces the first 'colors' palette entries, the rest become transparent
+void Texture::SetPalette(const unsigned char* rgba, int colors){
+	this->palette.assign(256*4, 0);
+	std::copy(rgba, rgba + 4*std::min(colors, 256), this->palette.begin());
+
+	glBindTexture(GL_TEXTURE_2D, this->palette_id);
+	if(this->palette_id == 0){
+		glGenTextures(1, &this->palette_id);
+		glBindTexture(GL_TEXTURE_2D, this->palette_id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &this->palette[0]));
+	} else {
+		GLCall(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE, &this->palette[0]));
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	TEXTURE_MEMORY.Track(this, this->GpuBytes());
+}
+
+// Number of mipmap levels down to 1x1
+static GLsizei MipLevels(int width, int height){
+	GLsizei levels = 1;
+	for(int side = std::max(width, height); side > 1; side /= 2) levels++;
+	return levels;
+}
+
+// Sends width*height pixels laid out as desc.Channels() bytes each to the GPU.
+// Fresh textures get immutable storage if supported. Mutable textures (e.g. a
+// placeholder) are respecified under the same id; immutable ones keep it when
+// the size is unchanged and are reallocated under a new id otherwise.
+void Texture::Upload(unsigned char* data){
+	static const GLenum formats[] = {0, GL_RED, 0, GL_RGB, GL_RGBA};
+	GLenum format = formats[this->desc.Channels()];
+	GLsizei levels = this->desc.mipmaps ? MipLevels(this->width, this->height) : 1;
+	bool respecify = true;
+
+	if(this->id != 0 and this->immutable){
+		GLint w, h;
+		glBindTexture(GL_TEXTURE_2D, this->id);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+		if(w == this->width and h == this->height) respecify = false;
+		else {
+			glDeleteTextures(1, &this->id);
+			this->id = 0;
+		}
+	}
+	if(this->id == 0){
+		glGenTextures(1, &this->id);
+		this->immutable = this->desc.immutable and (GLEW_ARB_texture_storage or GLEW_VERSION_4_2);
+	}
+
 	glBindTexture(GL_TEXTURE_2D, this->id);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);	
-	GLCall(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, this->width, this->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba_data));
-	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, this->desc.min_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, this->desc.mag_filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, this->desc.wrap_s);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, this->desc.wrap_t);	
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB and R rows are not 4-byte aligned
+	if(this->immutable){
+		if(respecify) GLCall(glTexStorage2D(GL_TEXTURE_2D, levels, this->desc.format, this->width, this->height));
+		GLCall(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->width, this->height, format, GL_UNSIGNED_BYTE, data));
+	} else {
+		GLCall(glTexImage2D(GL_TEXTURE_2D, 0, this->desc.format, this->width, this->height, 0, format, GL_UNSIGNED_BYTE, data));
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if(this->desc.mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	this->loaded = true;
+	TEXTURE_MEMORY.Track(this, this->GpuBytes());
+}
+
+size_t Texture::GpuBytes(){
+	// Drivers pad RGB8 texels to 4 bytes
+	size_t bpp = (this->desc.format == GL_R8) ? 1 : 4;
+	size_t bytes = 0;
+	int w = this->width, h = this->height;
+	GLsizei levels = this->desc.mipmaps ? MipLevels(w, h) : 1;
+	for(GLsizei l=0; l!=levels; ++l){
+		bytes += size_t(w) * h * bpp;
+		w = std::max(w/2, 1); h = std::max(h/2, 1);
+	}
+	if(this->palette_id != 0) bytes += 256*4;
+	return bytes;
+}
+
+// Only the rectangle is sent, reading it straight out of the full image
+void Texture::UploadRegion(unsigned char* data, int x, int y, int w, int h){
+	static const GLenum formats[] = {0, GL_RED, 0, GL_RGB, GL_RGBA};
+	int channels = this->desc.Channels();
+	if(this->id == 0 or w <= 0 or h <= 0) return;
+
+	glBindTexture(GL_TEXTURE_2D, this->id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, this->width);
+	unsigned char* first = data + (size_t(y) * this->width + x) * channels;
+	GLCall(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, formats[channels], GL_UNSIGNED_BYTE, first));
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if(this->desc.mipmaps) glGenerateMipmap(GL_TEXTURE_2D);
 	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	stbi_image_free(image_data);
 }
 
 void Texture::Bind(){
+	if(this->palette_id != 0){
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, this->palette_id);
+		glActiveTexture(GL_TEXTURE0);
+	}
 	glBindTexture(GL_TEXTURE_2D, this->id);
+	if(ACTIVE_SHADER) glUniform1i(ACTIVE_SHADER->indexed_loc, this->palette_id != 0);
 }
 
 void Texture::Unbind(){
@@ -86,15 +239,128 @@ void Texture::Unbind(){
 Texture::~Texture(){
 	Texture::Unbind();
 	glDeleteTextures(1, &this->id);
+	glDeleteTextures(1, &this->palette_id);
+	TEXTURE_MEMORY.Track(this, 0);
 }	
 
 
 
+// ============== TEXTURE CACHE METHODS
+
+TextureCache::TextureCache(): entries() {}
+
+// Returns the texture for 'path', decoding and uploading it only if no
+// other handle to it is alive. With a loader the decode is asynchronous.
+std::shared_ptr<Texture> TextureCache::Get(std::string& path, TextureLoader* loader, TextureDesc* desc){
+	auto it = this->entries.find(path);
+	if(it != this->entries.end()){
+		std::shared_ptr<Texture> cached = it->second.lock();
+		if(cached) return cached;
+	}
+
+	std::shared_ptr<Texture> texture = std::make_shared<Texture>();
+	if(desc) texture->desc = *desc;
+	if(loader) loader->Load(texture, path); // Kept alive by the loader until decoded
+	else texture->Init(path, texture->desc);
+	this->entries[path] = texture;
+	return texture;
+}
+
+// Forgets paths whose textures have been freed
+void TextureCache::Prune(){
+	for(auto it = this->entries.begin(); it != this->entries.end(); ){
+		if(it->second.expired()) it = this->entries.erase(it);
+		else ++it;
+	}
+}
+
+
+
+// ============== TEXTURE MEMORY METHODS
+
+TextureMemory::TextureMemory(): textures() {
+	total = 0;
+}
+
+void TextureMemory::Track(const Texture* texture, size_t bytes){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	auto it = this->textures.find(texture);
+	if(it != this->textures.end()){
+		this->total -= it->second;
+		if(bytes == 0) this->textures.erase(it);
+		else it->second = bytes;
+	} else if(bytes != 0) this->textures[texture] = bytes;
+	this->total += bytes;
+}
+
+size_t TextureMemory::Total(){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->total;
+}
+
+void TextureMemory::Report(std::ostream& out){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	std::vector<std::pair<size_t, const Texture*>> sorted;
+	for(auto& t : this->textures) sorted.push_back({t.second, t.first});
+	std::sort(sorted.rbegin(), sorted.rend());
+	out << "[GL] Texture memory: " << this->total << " bytes in " << sorted.size() << " textures" << std::endl;
+	for(auto& t : sorted){
+		out << "  " << t.first << "\t" << t.second->width << "x" << t.second->height
+		    << "\t" << (t.second->filepath.empty() ? "(unnamed)" : t.second->filepath) << std::endl;
+	}
+}
+
+
+// ============== TILESET METHODS
+
+Tileset::Tileset(): texture(), uvs() {
+	tile_w = 0; tile_h = 0; margin = 0; spacing = 0;
+	columns = 0; rows = 0; tilenum = 0;
+	pending = false;
+}
+
+void Tileset::Init(std::shared_ptr<Texture> texture, int tile_w, int tile_h, int margin, int spacing){
+	this->texture = texture;
+	this->tile_w = tile_w; this->tile_h = tile_h;
+	this->margin = margin; this->spacing = spacing;
+	this->columns = (texture->width - 2*margin + spacing) / (tile_w + spacing);
+	this->rows = (texture->height - 2*margin + spacing) / (tile_h + spacing);
+	this->tilenum = this->columns * this->rows;
+	this->pending = !texture->loaded; // A 1x1 placeholder holds no tiles
+
+	float tw = 1.0f/float(texture->width);
+	float th = 1.0f/float(texture->height);
+	this->uvs.resize(8 * this->tilenum);
+	for(int tile=0; tile!=this->tilenum; ++tile){
+		int x = margin + (tile % this->columns) * (tile_w + spacing);
+		int y = margin + (tile / this->columns) * (tile_h + spacing);
+		float u0 = tw*float(x), u1 = tw*float(x + tile_w);
+		float v0 = th*float(y), v1 = th*float(y + tile_h);
+		float texcoords[] = { u0, v1,  u1, v1,  u1, v0,  u0, v0 };
+		std::copy(texcoords, texcoords + 8, &this->uvs[8*tile]);
+	}
+}
+
+bool Tileset::Refresh(){
+	if(!this->pending or !this->texture or !this->texture->loaded) return false;
+	this->Init(this->texture, this->tile_w, this->tile_h, this->margin, this->spacing);
+	return true;
+}
+
+const float* Tileset::UV(int tile){
+	static const float none[8] = {0};
+	if(this->tilenum == 0) return none;
+	if(tile < 0 or tile >= this->tilenum) tile = (tile % this->tilenum + this->tilenum) % this->tilenum;
+	return &this->uvs[8*tile];
+}
+
+
 // ============== SHADER METHODS ================
 
 //Constructor
 Shader::Shader(): vpath(), fpath() {
 	program = 0;
+	indexed_loc = -1;
 }
 
 void Shader::Init(std::string& vpath, std::string& fpath){
@@ -118,6 +384,13 @@ void Shader::Init(std::string& vpath, std::string& fpath){
 	//Shader data has been copied to program and is no longer necessary.
 	glDeleteShader(vs);
 	glDeleteShader(fs);
+
+	// Texture units used by Texture::Bind
+	glUseProgram(this->program);
+	glUniform1i(glGetUniformLocation(this->program, "u_Texture"), 0);
+	glUniform1i(glGetUniformLocation(this->program, "u_Palette"), 1);
+	this->indexed_loc = glGetUniformLocation(this->program, "u_Indexed");
+	glUseProgram(0);
 }
 
 GLuint Shader::Compile(GLenum type, std::string& source){	
@@ -146,10 +419,12 @@ GLuint Shader::Compile(GLenum type, std::string& source){
 
 void Shader::Bind(){
 	GLCall(glUseProgram(this->program));
+	ACTIVE_SHADER = this;
 }
 
 void Shader::Unbind(){
 	GLCall(glUseProgram(0));
+	if(ACTIVE_SHADER == this) ACTIVE_SHADER = nullptr;
 }
 
 Shader::~Shader(){
@@ -163,20 +438,21 @@ Shader::~Shader(){
 Shape::Shape(): vertices(), indices(), texture() {
 	vbo=0; ibo=0; vertex_num=0; sdims=0; tdims=0;
 	//sx = 0; sy = 0; wx = 0; wy = 0;
-	//tilenum = 0; current_tile = -1;
+	tilenum = 0; current_tile = -1;
 }
 
 
 //Rectangle Initialization
-void Shape::Init(std::string& texture_path, GLuint sidex, GLuint sidey) {
+void Shape::Init(std::string& texture_path, GLuint sidex, GLuint sidey, TextureLoader* loader) {
 	// Param init
 	this->sdims = 2; // Spatial dimensions
        	this->tdims = 2; // Texture dimensions
 	this->vertices = std::vector<float>(16);
 	this->indices = std::vector<GLuint>(Engine::INDICES, Engine::INDICES+6);
-	this->texture.Init(texture_path);
+	this->texture = TEXTURE_CACHE.Get(texture_path, loader);
 	this->sidex = sidex; this->sidey = sidey;
-	this->tilenum = texture.width * texture.height / TSET_PIX / TSET_PIX;
+	this->tileset.Init(this->texture);
+	this->tilenum = this->tileset.tilenum;
 	
 	//GenerateRectangleCoords(&this->vertices[0], SCR_WIDTH/2-sidex/2, SCR_HEIGHT/2-sidex/2, sidex, sidey);
 
@@ -248,17 +524,23 @@ void Shape::Update(float* new_vertices){
 }
 
 void Shape::SetTexture(std::string& tpath){
-	if(this->texture.id != 0) return; //Texture already set
-	this->texture.Init(tpath);
+	if(this->texture) return; //Texture already set
+	this->texture = TEXTURE_CACHE.Get(tpath);
+	this->tileset.Init(this->texture);
+	this->tilenum = this->tileset.tilenum;
 }
 
-void Shape::SetTexture(Texture& new_texture){
-	if(this->texture.id != 0) return; //Texture already set
-	texture.id = new_texture.id;
-	texture.filepath = new_texture.filepath;
-	texture.width = new_texture.width;
-	texture.height = new_texture.height;
-	texture.channel_num = new_texture.channel_num;
+void Shape::SetTexture(std::shared_ptr<Texture> new_texture){
+	if(this->texture) return; //Texture already set
+	this->texture = new_texture;
+	this->tileset.Init(this->texture);
+	this->tilenum = this->tileset.tilenum;
+}
+
+void Shape::SetTileset(Tileset& new_tileset){
+	this->tileset = new_tileset;
+	this->texture = new_tileset.texture;
+	this->tilenum = new_tileset.tilenum;
 }
 
 
@@ -277,24 +559,15 @@ void Shape::SetPosition(int x, int y){
 
 
 void Shape::SetTile(int tile){
+	if(this->tileset.pending){
+		this->current_tile = tile; // Applied by Draw() once the texture has loaded
+		return;
+	}
 	if(tile >= this->tilenum) return;
 	this->current_tile = tile;
 
 	//Regenerate texture coordinates
-	float tx = float(TSET_PIX)/float(this->texture.width);
-	float ty = float(TSET_PIX)/float(this->texture.height);
-	
-	//int tile = this->logic_grid[which];
-	int x = tile % int(1.0f/tx);
-	int y = tile / int(1.0f/tx);
-
-	float texcoords[] = {
-		tx*float(x),     ty*(float(y)+1),
-		tx*(float(x)+1), ty*(float(y)+1),
-		tx*(float(x)+1), ty*float(y),
-		tx*float(x),     ty*float(y)
-	};
-	CopyTextureCoords(&this->vertices[0], texcoords);
+	CopyTextureCoords(&this->vertices[0], this->tileset.UV(tile));
 }
 
 
@@ -309,8 +582,12 @@ void Shape::Unbind(){
 }
 
 void Shape::Draw(){
+	if(this->tileset.Refresh()){
+		this->tilenum = this->tileset.tilenum;
+		if(this->current_tile >= 0) this->SetTile(this->current_tile);
+	}
 	Shape::Bind();
-	if(this->texture.id != 0) this->texture.Bind();
+	if(this->texture) this->texture->Bind();
 	Shape::Update();
 	GLCall(glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, nullptr));
 }
@@ -333,23 +610,7 @@ bool Shape::Collides(Shape& obstacle){
 }
 
 bool Shape::Collides(std::vector<float>& obstacle){
-	float x,y;
-	for(int i=0; i!=4; i++){
-		x = this->vertices[4*i];
-		y = this->vertices[4*i+1];
-		if(x>obstacle[V1_X] && x<obstacle[V2_X] && y>obstacle[V1_Y] && y<obstacle[V4_Y]){
-			return true;
-		}
-	}
-	
-	for(int i=0; i!=4; i++){
-		x = obstacle[4*i];
-		y = obstacle[4*i+1];
-		if(x>vertices[V1_X] && x<vertices[V2_X] && y>vertices[V1_Y] && y<vertices[V4_Y]){
-			return true;
-		}
-	}
-	return false;
+	return AABB::FromVertices(&this->vertices[0]).Overlaps(AABB::FromVertices(&obstacle[0]));
 }
 
 bool Shape::EnclosesPoint(float x, float y){
@@ -386,15 +647,31 @@ Shape::~Shape(){
 
 Tilemap::Tilemap(): shape(), tileset(), ftmap() {
 	height=0; width=0; tilesize=0, tset_tilenum=0;
+	origin_x=0; origin_y=0; tile_w=0; tile_h=0;
 	tile_grid=nullptr; logic_grid=nullptr;
 	//layers = nullptr;
 }
 
 
-void Tilemap::Init(std::string &tilemap_file, std::string &tileset_file, int tilesize) {
+void Tilemap::Init(std::string &tilemap_file, std::string &tileset_file, int tilesize, TextureLoader* loader) {
+	// Tilesets use few colours: store them as palette indices when possible
+	TextureDesc desc;
+	desc.indexed = true;
+	Tileset tset;
+	tset.Init(TEXTURE_CACHE.Get(tileset_file, loader, &desc)); //Rely on internal shape texture instead
+	this->Init(tilemap_file, tset, tilesize);
+}
+
+void Tilemap::Init(std::string &tilemap_file, Tileset &tileset, int tilesize) {
+	this->Load(tilemap_file, tileset, tilesize);
+	this->Upload();
+}
+
+// No GL calls: the vertices are only kept in 'shape' until Upload()
+void Tilemap::Load(std::string &tilemap_file, Tileset &tileset, int tilesize) {
 		
 	this->Read(tilemap_file);
-	this->tileset.Init(tileset_file); //Rely on internal shape texture instead
+	this->tileset = tileset;
 
 	#ifdef DEBUG
 	std::cout << "[DEBUG] Logic Grid" << std::endl;
@@ -413,7 +690,7 @@ void Tilemap::Init(std::string &tilemap_file, std::string &tileset_file, int til
 
 	// Initialize params
 	this->tilesize = tilesize;
-	this->tset_tilenum = this->tileset.width * this->tileset.height / TSET_PIX / TSET_PIX;
+	this->tset_tilenum = this->tileset.tilenum;
 
 	std::vector<float> vertices(width*height*16);
 	std::vector<GLuint> indices(width*height*6);
@@ -436,58 +713,76 @@ void Tilemap::Init(std::string &tilemap_file, std::string &tileset_file, int til
 	}
 	*/
 	
-	this->shape.Init(vertices, indices);
+	this->shape.sdims = 2;
+	this->shape.tdims = 2;
+	this->shape.vertices.swap(vertices);
+	this->shape.indices.swap(indices);
+	this->shape.vertex_num = this->shape.vertices.size() / 4;
+	this->origin_x = this->shape.vertices[V1_X];
+	this->origin_y = this->shape.vertices[V1_Y];
+	this->tile_w = this->shape.vertices[V2_X] - this->shape.vertices[V1_X];
+	this->tile_h = this->shape.vertices[V4_Y] - this->shape.vertices[V1_Y];
 	this->GenTextureCoords();
 	this->CenterSpawn();
 }
 
+void Tilemap::Upload(){
+	// Shape::Init copies its arguments
+	std::vector<float> vertices(this->shape.vertices);
+	std::vector<GLuint> indices(this->shape.indices);
+	this->shape.Init(vertices, indices);
+}
+
 void Tilemap::Write(std::string &filename){
 }
 
 void Tilemap::Read(std::string &filename){
 	
-	std::fstream file(filename.c_str(), std::ios::binary|std::ios::in );
-	if(!file.is_open()){
-		std::cerr << "Error opening file " << filename << std::endl;
-		exit(-1);
+	// Layout: 1 byte width, 1 byte height, tile grid, logic grid
+	const unsigned char* data;
+	size_t size;
+	std::vector<char> file_data;
+	if(!ASSET_PACK.Find(filename, data, size)){
+		std::fstream file(filename.c_str(), std::ios::binary|std::ios::in );
+		if(!file.is_open()){
+			std::cerr << "Error opening file " << filename << std::endl;
+			exit(-1);
+		}
+		file_data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		file.close();
+		data = (const unsigned char*)file_data.data();
+		size = file_data.size();
 	}
 	this->ftmap = filename;
-	char ch;
 
 	// Reading width and height
-	file.get(ch);
-	this->width = int(ch);
-	file.get(ch);
-	this->height = int(ch);
+	if(size < 2){
+		std::cout << "Could not read tilemap" << std::endl;
+		exit(-1);
+	}
+	this->width = int((char)data[0]);
+	this->height = int((char)data[1]);
+	int cells = this->width*this->height;
+	if(size < size_t(2 + 2*cells)){
+		std::cout << "Could not read tilemap" << std::endl;
+		exit(-1);
+	}
 	
-	this->tile_grid = new int[this->width*this->height];
-	this->logic_grid = new int[this->width*this->height];
+	this->tile_grid = new int[cells];
+	this->logic_grid = new int[cells];
 
 	// Reading tile grid
-	for(int i=0; i!=this->width*this->height; ++i){
-		if(!file.good()){
-			std::cout << "Could not read tilemap" << std::endl;
-			exit(-1);
-		}
-		file.get(ch);
-		this->tile_grid[i] = int(ch);
-	}
-	// Reading tile grid
-	for(int i=0; i!=this->width*this->height; ++i){
-		if(!file.good()){
-			std::cout << "Could not read tilemap" << std::endl;
-			exit(-1);
-		}
-		file.get(ch);
-		this->logic_grid[i] = int(ch);
-	}
-	file.close();
+	for(int i=0; i!=cells; ++i) this->tile_grid[i] = int((char)data[2 + i]);
+	// Reading logic grid
+	for(int i=0; i!=cells; ++i) this->logic_grid[i] = int((char)data[2 + cells + i]);
 }
 
 void Tilemap::Move(float dx, float dy){
 	for(int j=0; j!=height*width; ++j){
 		VerticesTranslate(&shape.vertices[0]+16*j, dx, dy);
 	}
+	origin_x += dx;
+	origin_y += dy;
 }
 
 void Tilemap::CenterSpawn(){
@@ -502,45 +797,59 @@ void Tilemap::CenterSpawn(){
 		}
 	}
 
-	float *spawn_vertices = &this->shape.vertices[0] + 16*spawn_ind;
-	float spawn_cx = (spawn_vertices[V2_X] + spawn_vertices[V1_X])/2.0;
-	float spawn_cy = (spawn_vertices[V4_Y] + spawn_vertices[V1_Y])/2.0;
-	this->Move(-spawn_cx, -spawn_cy);
+	this->CenterOn(spawn_ind);
+}
+
+void Tilemap::CenterOn(int cell){
+	float *cell_vertices = &this->shape.vertices[0] + 16*cell;
+	float cx = (cell_vertices[V2_X] + cell_vertices[V1_X])/2.0;
+	float cy = (cell_vertices[V4_Y] + cell_vertices[V1_Y])/2.0;
+	this->Move(-cx, -cy);
 }
 
 void Tilemap::GenTileTextureCoords(int which){
-	float tx = float(TSET_PIX)/float(this->tileset.width);
-	float ty = float(TSET_PIX)/float(this->tileset.height);
-	
 	int tile = this->logic_grid[which];
-	int x = tile % int(1.0f/tx);
-	int y = tile / int(1.0f/tx);
-
-	float texcoords[] = {
-		tx*float(x),     ty*(float(y)+1),
-		tx*(float(x)+1), ty*(float(y)+1),
-		tx*(float(x)+1), ty*float(y),
-		tx*float(x),     ty*float(y)
-	};
-	CopyTextureCoords(&this->shape.vertices[0]+which*16, texcoords);
+	CopyTextureCoords(&this->shape.vertices[0]+which*16, this->tileset.UV(tile));
 }
 
+// Gathers every tile's coordinates from the tileset table
 void Tilemap::GenTextureCoords(){
-	for(int i=0; i!=this->height*this->width; ++i){
-		this->GenTileTextureCoords(i);
+	float* v = &this->shape.vertices[0];
+	for(int i=0; i!=this->height*this->width; ++i, v += 16){
+		const float* uv = this->tileset.UV(this->logic_grid[i]);
+		v[V1_T] = uv[0]; v[V1_S] = uv[1];
+		v[V2_T] = uv[2]; v[V2_S] = uv[3];
+		v[V3_T] = uv[4]; v[V3_S] = uv[5];
+		v[V4_T] = uv[6]; v[V4_S] = uv[7];
 	}
 }
 
 void Tilemap::Draw(){
-	tileset.Bind();
+	if(tileset.Refresh()) this->GenTextureCoords(); // Tileset finished loading
+	tileset.texture->Bind();
 	shape.Draw();
 }
 
 GLuint Tilemap::GetTile(float x, float y){
-	for(int i=0; i!=height*width; ++i){
-		if(VerticesEnclose(&this->shape.vertices[16*i],x,y)) return i;
+	float fc = std::floor((x - origin_x) / tile_w);
+	float fr = std::floor((y - origin_y) / tile_h);
+	if(fc < 0 or fr < 0 or fc >= width or fr >= height) return height*width;
+	return GLuint(fc) + GLuint(fr)*width;
+}
+
+void Tilemap::GetTiles(const float* xs, const float* ys, int n, GLuint* tiles){
+	// Branch-free body so the loop vectorises
+	GLuint outside = height*width;
+	for(int i=0; i!=n; ++i){
+		float fc = std::floor((xs[i] - origin_x) / tile_w);
+		float fr = std::floor((ys[i] - origin_y) / tile_h);
+		bool inside = fc >= 0 and fr >= 0 and fc < width and fr < height;
+		tiles[i] = inside ? GLuint(fc) + GLuint(fr)*width : outside;
 	}
-	return height*width;
+}
+
+void Tilemap::GetTiles(const float* points, int n, GLuint* tiles){
+	for(int i=0; i!=n; ++i) tiles[i] = this->GetTile(points[2*i], points[2*i+1]);
 }
 
 float* Tilemap::GetTileVertices(int tile){
@@ -619,6 +928,13 @@ GLFWwindow *GLBegin(GLuint width, GLuint height, bool fullscreen){
 }
 
 std::string* FileReadLines(std::string& lines, const char* filepath){
+	const unsigned char* data;
+	size_t size;
+	if(ASSET_PACK.Find(filepath, data, size)){
+		lines.assign((const char*)data, size);
+		return &lines;
+	}
+
 	std::ifstream stream(filepath);
 	std::string line;
 	std::stringstream ss;
@@ -664,7 +980,7 @@ void GenerateRectangleCoords(float* vertices, int x, int y, int side_x, int side
 }
 
 //Copies texture coordinates into a set of vertices.
-float* CopyTextureCoords(float *vertices, float *texcoords){
+float* CopyTextureCoords(float *vertices, const float *texcoords){
 	GLuint ind[] = {V1_T, V1_S, V2_T, V2_S, V3_T, V3_S, V4_T, V4_S};
 	for(int i=0; i!=8; ++i) vertices[ind[i]] = texcoords[i];
 	return vertices;
@@ -711,40 +1027,4 @@ void PixelToScreen(int px, int py, float &sx, float &sy){
 	sy = 2.0f*float(py)/float(SCR_HEIGHT) - 1;
 }
 
-/*
-Converts pixel data from RGB to RGBA.
-Return data must have at least (total bytes + pixels) memory spaces.
-Fills new alpha channels with given value (default = 255
-*/
-unsigned char* rgba(unsigned char *dest, unsigned char* data, int pixels, unsigned char alpha){
-	unsigned char* ptr = data;
-	unsigned char* cpy = dest;
-	for(int p=0; p!=pixels; ++p){
-		std::copy(ptr, ptr+3, cpy); // copy rgb
-		ptr += 3;
-		cpy += 3;
-		*cpy = (unsigned char)alpha; // add alpha, default 0xFF
-		cpy++;
-	}
-	return dest;
-}
-
-/*
-Converts pixel data from RGBA to RGB.
-Return data must have at least (total bytes - pixels) memory spaces.
-*/
-unsigned char* rgb(unsigned char* dest, unsigned char* data, int pixels){
-	unsigned char* ptr = data;
-	unsigned char* cpy = dest;
-	for(int p=0; p!=pixels; ++p){
-		std::copy(ptr, ptr+3, cpy); // copy rgb
-		ptr += 4;
-		cpy += 3;
-	}
-	return dest;
-}
-
 } // namespace Engine
-
-
-
@@ -9,7 +9,6 @@
 - Improve error management: no preprocessor directives (GLCall, redefining assert...)i
 - Debug messages with defines
 - Learning some pixel art
-- Tilemap Portals
 
 Development
 - Find better place to put to-do.
@@ -49,6 +48,9 @@ VERSIONS
 #include <sstream>
 #include <cmath>
 #include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
 
 #include <GL/glew.h>
 #include <GL/glxew.h>
@@ -87,6 +89,9 @@ extern int KEYSTATES[ KEYNUM ];
 
 extern GLFWwindow* WINDOW;
 
+struct Shader;
+extern Shader* ACTIVE_SHADER; // Last bound shader program
+
 // Colors
 
 #define COLOR_RED {255,0,0}
@@ -112,23 +117,83 @@ enum TileMapLogicIndices {
 };
 
 
+struct Image;
+
+// How a texture is stored and sampled on the GPU
+struct TextureDesc {
+	GLenum format; // Sized internal format: GL_RGBA8, GL_RGB8 or GL_R8
+	bool mipmaps; // Only worth it with a mipmapped min_filter
+	bool immutable; // Allocate with glTexStorage2D when available
+	bool indexed; // Store as palette indices if the image has <= 256 colours
+	GLenum min_filter, mag_filter;
+	GLenum wrap_s, wrap_t;
+
+	TextureDesc(); // RGBA8, no mipmaps, nearest filtering, repeat, not indexed
+	int Channels(); // Bytes per pixel of the data uploaded for 'format'
+};
+
 struct Texture {
 	GLuint id;
 	int width, height, channel_num;
 	std::string filepath;
+	bool loaded; // False while a placeholder awaits its pixel data
+	TextureDesc desc;
+	bool immutable; // Storage was allocated with glTexStorage2D
+	GLuint palette_id; // 256x1 RGBA texture, 0 unless indexed
+	std::vector<unsigned char> palette; // RGBA entries of palette_id
 	
 	Texture(); //Constructor
 	//Texture(string& fpath, int mode=GL_RGBA); //DELETE
 	void Init(std::string& fpath, int mode=GL_RGBA);
+	void Init(std::string& fpath, TextureDesc& desc);
+	void Upload(unsigned char* data); // Uploads width*height pixels of desc.Channels() bytes
+	void UploadRegion(unsigned char* data, int x, int y, int w, int h); // Sub-rectangle of a full width*height image, after Upload
+	void UploadImage(Image& image); // Upload, palettizing first if desc.indexed
+	void SetPalette(const unsigned char* rgba, int colors); // Palette swap
+	size_t GpuBytes(); // Video memory used by all levels
 	void Bind();
 	void Unbind();
 	~Texture(); //Destructor
+
+	// Owns its GL id: share it through TextureCache handles instead of copying
+	Texture(const Texture&) = delete;
+	Texture& operator=(const Texture&) = delete;
+};
+
+struct TextureLoader;
+
+// Hands out shared handles so each image is decoded and uploaded once,
+// however many shapes use it. The GL texture is freed with its last handle.
+struct TextureCache {
+	std::unordered_map<std::string, std::weak_ptr<Texture>> entries;
+
+	TextureCache(); //Constructor
+	// 'desc' only applies if the texture is not cached yet
+	std::shared_ptr<Texture> Get(std::string& path, TextureLoader* loader = nullptr, TextureDesc* desc = nullptr);
+	void Prune();
 };
 
+extern TextureCache TEXTURE_CACHE;
+
+// Video memory held by every live texture
+struct TextureMemory {
+	std::mutex mtx;
+	std::unordered_map<const Texture*, size_t> textures;
+	size_t total;
+
+	TextureMemory(); //Constructor
+	void Track(const Texture* texture, size_t bytes); // 0 bytes forgets the texture
+	size_t Total();
+	void Report(std::ostream& out); // One line per texture, largest first
+};
+
+extern TextureMemory TEXTURE_MEMORY;
+
 struct Shader {
 	std::string vpath, fpath; //filepaths
 	GLuint program;
 	GLuint uniform;
+	GLint indexed_loc; // u_Indexed: sample u_Texture through u_Palette
 	double color[4];
 	
 	Shader(); //Constructor
@@ -139,6 +204,22 @@ struct Shader {
 	~Shader(); //Destructor
 };
 
+// Grid of tiles inside a texture, with the texture coordinates of every
+// tile computed once so shapes and tilemaps only copy them.
+struct Tileset {
+	std::shared_ptr<Texture> texture; // Must be loaded before Init
+	int tile_w, tile_h; // Tile size in pixels
+	int margin, spacing; // Pixels around the sheet and between tiles
+	int columns, rows, tilenum;
+	std::vector<float> uvs; // 8 per tile, in CopyTextureCoords order
+	bool pending; // Built while 'texture' was still a loader placeholder: no tiles yet
+
+	Tileset(); //Constructor
+	void Init(std::shared_ptr<Texture> texture, int tile_w = TSET_PIX, int tile_h = TSET_PIX, int margin = 0, int spacing = 0);
+	bool Refresh(); // Builds the tiles of a pending tileset once its texture has loaded, true if it did
+	const float* UV(int tile); // Out of range tiles wrap around the sheet
+};
+
 
 struct Shape {
 	GLuint vbo, ibo; //Vertex and Index Buffer Object
@@ -146,7 +227,8 @@ struct Shape {
 	GLuint sdims, tdims; // Spatial and texture dimensions
 	std::vector<float> vertices;
 	std::vector<GLuint> indices;
-	Texture texture;
+	std::shared_ptr<Texture> texture;
+	Tileset tileset; // How 'texture' is split into tiles
 	int tilenum, current_tile;
 	int sidex, sidey; //Pixel side size
 	int wx, wy; //World coords
@@ -154,13 +236,14 @@ struct Shape {
 
 	// Methods
 	Shape(); //Constructor	
-	void Init(std::string& texture_path, GLuint sidex, GLuint sidey); // Simple square/rectangle
+	void Init(std::string& texture_path, GLuint sidex, GLuint sidey, TextureLoader* loader = nullptr); // Simple square/rectangle
 	void Init(std::vector<float>& vertices, std::vector<GLuint>& indices, int sdims=2, int tdims=2); //Generic shape, no texture
 	void Update(float* new_vertices = nullptr);
 	void SetTexture(std::string& path);
-	void SetTexture(Texture& newTexture);
+	void SetTexture(std::shared_ptr<Texture> newTexture);
 	void SetPosition(int x, int y); //Position in pixel coordinates
 	void SetPosition(float x, float y); //Position in screen coordinates
+	void SetTileset(Tileset& tileset); //Shares the tileset's texture and tile layout
 	void SetTile(int tile); //Choose tile texture for shape from tileset
 	void Bind();
 	void Unbind();
@@ -176,25 +259,33 @@ struct Shape {
 
 struct Tilemap {
 	int height, width, tilesize;
+	float origin_x, origin_y; // Screen position of the lower-left corner of tile 0
+	float tile_w, tile_h; // Tile size in screen coordinates
 	int *tile_grid; // Which tile texture to place
 	int *logic_grid; // Collisions, boundaries, portals, etc
 	//int *layers[]; // Graphical layers on top	
 	Shape shape; //includes map vertices and indices
-	Texture tileset;
+	Tileset tileset;
 	GLuint tset_tilenum;
 	std::string ftmap; //Filename
 
 	Tilemap(); //Constructor
-	void Init(std::string &tilemap_file, std::string &tileset_file, int tilesize = 50);
+	void Init(std::string &tilemap_file, std::string &tileset_file, int tilesize = 50, TextureLoader* loader = nullptr); // TSET_PIX tiles
+	void Init(std::string &tilemap_file, Tileset &tileset, int tilesize = 50);
+	void Load(std::string &tilemap_file, Tileset &tileset, int tilesize = 50); // CPU side of Init, safe off the main thread
+	void Upload(); // GL side of Init, main thread only
 	void Write(std::string &filename); //Saves tilemap on file
 	void Read(std::string &filename); //Reads tilemap from file
 	void Move(float dx, float dy);
 	void CenterSpawn(); //Centers screen/player on spawn
+	void CenterOn(int cell); //Centers screen/player on a tile
 	void GenTileTextureCoords(int which);
 	void GenTextureCoords();
 	void Draw();
 	bool TileEncloses(GLuint tile, float x, float y);
-	GLuint GetTile(float x, float y);
+	GLuint GetTile(float x, float y); // width*height if outside the map
+	void GetTiles(const float* xs, const float* ys, int n, GLuint* tiles); // Batch GetTile
+	void GetTiles(const float* points, int n, GLuint* tiles); // Interleaved x,y pairs
 	float* GetTileVertices(int tile);
 	~Tilemap(); //Destructor
 };
@@ -216,7 +307,7 @@ bool VerticesEnclose(float* vex, float x, float y);
 
 void GenerateRectangleCoords(float* vertices, int x, int y, int side_x, int side_y);
 
-float* CopyTextureCoords(float *vertices, float *texcoords);
+float* CopyTextureCoords(float *vertices, const float *texcoords);
 
 float* CopyPositionCoords(float *vertices, float *poscoords);
 
@@ -233,6 +324,14 @@ void ScreenToPixel(float sx, float sy, int &px, int &py);
 //Transform from screen pixels to screen.
 void PixelToScreen(int px, int py, float &sx, float &sy);
 
+// Pixel conversion kernels, picked at startup from what the CPU supports
+enum PixelKernel { KERNEL_SCALAR = 0, KERNEL_SSSE3, KERNEL_AVX2 };
+
+extern PixelKernel PIXEL_KERNEL;
+
+// Forces a kernel, e.g. for benchmarking. False if the CPU lacks it.
+bool SetPixelKernel(PixelKernel kernel);
+
 unsigned char* rgba(unsigned char *dest, unsigned char* data, int pixels, unsigned char alpha=255);
 
 unsigned char* rgb(unsigned char* dest, unsigned char* data, int pixels);
@@ -0,0 +1,240 @@
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+
+#ifndef __WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "stb_image.h"
+
+#include "Image.h"
+#include "Pack.h"
+
+
+namespace Engine {
+
+std::string IMAGE_CACHE_DIR = ".cache/images";
+
+#ifndef __WIN32
+
+static const char CACHE_MAGIC[4] = {'R', 'P', 'G', 'I'};
+static const uint32_t CACHE_VERSION = 2;
+
+// Layout of a cache file: header, source key, padding, pixels
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	int32_t width, height, channel_num;
+	uint32_t path_len;
+	int64_t src_size, src_stamp; // See CacheSource
+	uint64_t data_offset; // Pixels start here, 64-byte aligned
+};
+
+// What an entry was decoded from. Loose files are stamped with their
+// modification time, pack blobs with a hash of their bytes, and the two
+// never share an entry.
+struct CacheSource {
+	std::string key; // Path, prefixed with "pack:" for pack blobs
+	int64_t size, stamp;
+};
+
+// FNV-1a: hashing a blob costs far less than decoding it
+static int64_t BlobHash(const unsigned char* data, size_t size){
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i=0; i!=size; ++i){
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return int64_t(hash);
+}
+
+static std::string CachePath(const std::string& path, int channels){
+	std::stringstream ss;
+	ss << IMAGE_CACHE_DIR << '/' << std::hex << std::hash<std::string>{}(path) << '_' << channels << ".img";
+	return ss.str();
+}
+
+// Creates every directory in the path, like 'mkdir -p'
+static void MakeDirs(const std::string& dir){
+	for(size_t i = 1; i <= dir.size(); ++i){
+		if(i == dir.size() or dir[i] == '/') mkdir(dir.substr(0, i).c_str(), 0755);
+	}
+}
+
+static bool MapCached(Image& img, const std::string& cache_path, const CacheSource& src){
+	int fd = open(cache_path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0 or size_t(st.st_size) < sizeof(CacheHeader)){
+		close(fd);
+		return false;
+	}
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping stays valid
+	if(map == MAP_FAILED) return false;
+
+	const CacheHeader* hdr = static_cast<const CacheHeader*>(map);
+	const char* stored_path = static_cast<const char*>(map) + sizeof(CacheHeader);
+	uint64_t data_size = uint64_t(hdr->width) * hdr->height * hdr->channel_num;
+	bool valid = std::memcmp(hdr->magic, CACHE_MAGIC, 4) == 0
+		and hdr->version == CACHE_VERSION
+		and hdr->src_size == src.size
+		and hdr->src_stamp == src.stamp
+		and hdr->path_len == src.key.size()
+		and sizeof(CacheHeader) + hdr->path_len <= size_t(st.st_size)
+		and src.key.compare(0, src.key.size(), stored_path, hdr->path_len) == 0
+		and hdr->data_offset + data_size <= uint64_t(st.st_size);
+	if(!valid){
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	img.mapping = map;
+	img.mapping_size = st.st_size;
+	img.width = hdr->width;
+	img.height = hdr->height;
+	img.channel_num = hdr->channel_num;
+	img.pixels = static_cast<unsigned char*>(map) + hdr->data_offset;
+	return true;
+}
+
+// Writes to a temporary file first so readers never see a partial entry
+static void WriteCached(const Image& img, const std::string& cache_path, const CacheSource& src){
+	const std::string& path = src.key;
+	CacheHeader hdr;
+	std::memcpy(hdr.magic, CACHE_MAGIC, 4);
+	hdr.version = CACHE_VERSION;
+	hdr.width = img.width;
+	hdr.height = img.height;
+	hdr.channel_num = img.channel_num;
+	hdr.path_len = path.size();
+	hdr.src_size = src.size;
+	hdr.src_stamp = src.stamp;
+	hdr.data_offset = (sizeof(CacheHeader) + path.size() + 63) & ~uint64_t(63);
+
+	MakeDirs(IMAGE_CACHE_DIR);
+	std::string tmp_path = cache_path + ".XXXXXX";
+	int fd = mkstemp(&tmp_path[0]);
+	if(fd < 0) return;
+
+	std::string padding(hdr.data_offset - sizeof(CacheHeader) - path.size(), '\0');
+	size_t data_size = size_t(img.width) * img.height * img.channel_num;
+	bool ok = write(fd, &hdr, sizeof(hdr)) == ssize_t(sizeof(hdr))
+		and write(fd, path.data(), path.size()) == ssize_t(path.size())
+		and write(fd, padding.data(), padding.size()) == ssize_t(padding.size())
+		and write(fd, img.pixels, data_size) == ssize_t(data_size);
+	close(fd);
+
+	if(!ok or rename(tmp_path.c_str(), cache_path.c_str()) != 0){
+		std::cerr << "Warning: could not write image cache '" << cache_path << "'" << std::endl;
+		unlink(tmp_path.c_str());
+	}
+}
+
+#endif // __WIN32
+
+
+Image::Image(){
+	pixels = nullptr;
+	width = 0; height = 0; channel_num = 0;
+	mapping = nullptr; mapping_size = 0;
+}
+
+bool Image::Load(const std::string& path, int channels){
+	this->Free();
+
+	// The pack takes precedence over loose files, as everywhere else
+	const unsigned char* packed;
+	size_t packed_size;
+	bool in_pack = ASSET_PACK.Find(path, packed, packed_size);
+
+#ifndef __WIN32
+	CacheSource src;
+	std::string cache_path;
+	bool cacheable = !IMAGE_CACHE_DIR.empty();
+	if(cacheable and in_pack){
+		src.key = "pack:" + path;
+		src.size = int64_t(packed_size);
+		src.stamp = BlobHash(packed, packed_size);
+	} else if(cacheable){
+		struct stat st;
+		cacheable = stat(path.c_str(), &st) == 0;
+		src.key = path;
+		src.size = int64_t(st.st_size);
+		src.stamp = int64_t(st.st_mtime);
+	}
+	if(cacheable){
+		cache_path = CachePath(src.key, channels);
+		if(MapCached(*this, cache_path, src)) return true;
+	}
+#endif
+
+	int file_channels;
+	if(in_pack){
+		this->pixels = stbi_load_from_memory(packed, int(packed_size), &this->width, &this->height, &file_channels, channels);
+	} else {
+		this->pixels = stbi_load(path.c_str(), &this->width, &this->height, &file_channels, channels);
+	}
+	if(!this->pixels) return false;
+	this->channel_num = channels ? channels : file_channels;
+
+#ifndef __WIN32
+	if(cacheable) WriteCached(*this, cache_path, src);
+#endif
+	return true;
+}
+
+void Image::Free(){
+#ifndef __WIN32
+	if(this->mapping) munmap(this->mapping, this->mapping_size);
+	else
+#endif
+	if(this->pixels) stbi_image_free(this->pixels);
+	this->pixels = nullptr;
+	this->mapping = nullptr;
+	this->mapping_size = 0;
+}
+
+bool Image::Palettize(std::vector<unsigned char>& indices, std::vector<unsigned char>& palette) const {
+	if(this->channel_num != 4) return false;
+	size_t pixel_num = size_t(this->width) * this->height;
+	std::unordered_map<uint32_t, unsigned char> lookup;
+	indices.resize(pixel_num);
+	palette.clear();
+
+	const unsigned char* src = this->pixels;
+	uint32_t last = 0;
+	unsigned char last_index = 0;
+	bool has_last = false;
+	for(size_t p=0; p!=pixel_num; ++p){
+		uint32_t color;
+		std::memcpy(&color, src + 4*p, 4); // Pixels need not be 4-byte aligned
+		// Neighbouring pixels usually share a colour
+		if(!has_last or color != last){
+			auto it = lookup.find(color);
+			if(it == lookup.end()){
+				if(lookup.size() == 256) return false;
+				last_index = (unsigned char)lookup.size();
+				lookup[color] = last_index;
+				palette.insert(palette.end(), src + 4*p, src + 4*p + 4);
+			} else last_index = it->second;
+			last = color;
+			has_last = true;
+		}
+		indices[p] = last_index;
+	}
+	return true;
+}
+
+} // namespace Engine
@@ -0,0 +1,46 @@
+/*
+
+	Decoded images and the on-disk decode cache
+
+Image::Load first looks for a pre-decoded copy of the file in
+IMAGE_CACHE_DIR. A hit is mapped into memory and its pixels can be passed to
+glTexImage2D without decoding or copying. On a miss the file is decoded with
+stb_image and the result is written to the cache for the next launch.
+
+Like every loader, Image::Load reads the asset pack before loose files, and
+cache entries record which of the two they were decoded from. Entries are
+keyed by source and channel count, and are only used while a loose file
+keeps the size and modification time recorded in them, or a pack blob the
+size and content hash. Deleting the directory is always safe.
+
+*/
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Engine {
+
+extern std::string IMAGE_CACHE_DIR; // Empty disables the disk cache
+
+struct Image {
+	unsigned char* pixels;
+	int width, height, channel_num;
+	void* mapping; // Cache file mapping, null if decoded by stb_image
+	size_t mapping_size;
+
+	Image(); //Constructor
+	// Channels: desired channel number, 0 keeps the file's own.
+	bool Load(const std::string& path, int channels = 0);
+	void Free(); // Not a destructor: images travel between threads by copy
+	// RGBA images with at most 256 distinct colours: one index byte per
+	// pixel plus an RGBA palette. False if there are more colours.
+	bool Palettize(std::vector<unsigned char>& indices, std::vector<unsigned char>& palette) const;
+};
+
+} // namespace Engine
+
+#endif // IMAGE_H
@@ -0,0 +1,231 @@
+
+#include <algorithm>
+#include <vector>
+#include <utility>
+
+#include "Engine.h"
+#include "Collision.h"
+#include "Lighting.h"
+
+
+namespace Engine {
+
+// More rectangles than this are uploaded as their bounding box
+static const size_t MAX_UPLOAD_RECTS = 8;
+
+
+// ============== LIGHT GRID METHODS
+
+LightGrid::LightGrid(): levels(), sources(), lights(), lit(), dark(), dirty(), texture() {
+	width = 0; height = 0;
+	falloff = 24;
+	ambient = 1.0f;
+	walls = nullptr;
+	program = 0;
+	lit_loc = -1; origin_loc = -1; size_loc = -1; ambient_loc = -1; light_loc = -1;
+}
+
+void LightGrid::Init(const BlockBitmap& walls, int falloff){
+	this->walls = &walls;
+	this->width = walls.width;
+	this->height = walls.height;
+	this->falloff = std::max(falloff, 1);
+	this->levels.assign(size_t(width) * height, 0);
+	this->sources.assign(size_t(width) * height, 0);
+	this->lights.clear();
+	this->dirty.clear();
+	this->dirty.push_back(LightRect{0, 0, width - 1, height - 1});
+}
+
+int LightGrid::Add(int cell, int level){
+	this->lights.push_back(Light{cell, std::min(std::max(level, 0), 255)});
+	this->Source(cell);
+	this->Emit(cell, this->sources[cell]);
+	return int(this->lights.size()) - 1;
+}
+
+void LightGrid::Move(int id, int cell){
+	int old = this->lights[id].cell;
+	if(old == cell) return;
+	this->lights[id].cell = cell;
+	this->Source(old);
+	this->Darken(old);
+	this->Source(cell);
+	this->Emit(cell, this->sources[cell]);
+}
+
+void LightGrid::SetLevel(int id, int level){
+	this->lights[id].level = std::min(std::max(level, 0), 255);
+	this->Source(this->lights[id].cell);
+	this->Darken(this->lights[id].cell);
+}
+
+void LightGrid::Remove(int id){
+	int old = this->lights[id].cell;
+	this->lights[id].cell = -1;
+	this->Source(old);
+	this->Darken(old);
+}
+
+void LightGrid::Update(int cell){
+	if(this->walls->Get(cell % width, cell / width)) this->Darken(cell);
+	else this->Emit(cell, this->sources[cell]);
+}
+
+int LightGrid::Level(int cell){
+	return this->levels[cell];
+}
+
+void LightGrid::Source(int cell){
+	if(cell < 0) return;
+	int level = 0;
+	for(Light& light : this->lights){
+		if(light.cell == cell) level = std::max(level, light.level);
+	}
+	this->sources[cell] = uint8_t(level);
+}
+
+void LightGrid::Touch(int cell){
+	LightRect& rect = this->dirty.back();
+	int col = cell % width, row = cell / width;
+	rect.col0 = std::min(rect.col0, col); rect.col1 = std::max(rect.col1, col);
+	rect.row0 = std::min(rect.row0, row); rect.row1 = std::max(rect.row1, row);
+}
+
+void LightGrid::Emit(int cell, int level){
+	if(cell < 0) return;
+	this->dirty.push_back(LightRect{width, height, -1, -1});
+	if(level > this->levels[cell]){
+		this->levels[cell] = uint8_t(level);
+		this->Touch(cell);
+	}
+	this->lit.push_back(cell);
+	this->Spread();
+}
+
+void LightGrid::Spread(){
+	for(size_t i=0; i!=this->lit.size(); ++i){
+		int cell = this->lit[i];
+		int col = cell % width, row = cell / width;
+		int next = this->levels[cell] - this->falloff;
+		// Walls are lit but cast nothing further
+		if(next <= 0 or this->walls->Get(col, row)) continue;
+		int neighbours[4] = {cell - 1, cell + 1, cell - width, cell + width};
+		bool inside[4] = {col > 0, col < width - 1, row > 0, row < height - 1};
+		for(int k=0; k!=4; ++k){
+			int n = neighbours[k];
+			if(!inside[k] or this->levels[n] >= next) continue;
+			this->levels[n] = uint8_t(next);
+			this->Touch(n);
+			this->lit.push_back(n);
+		}
+	}
+	this->lit.clear();
+}
+
+// Light fades one step per tile, so a neighbour dimmer than the cleared
+// cell may have been lit through it and is cleared too. Brighter or equal
+// neighbours got their light elsewhere: they flood back into the gap.
+void LightGrid::Darken(int cell){
+	if(cell < 0) return;
+	this->dirty.push_back(LightRect{width, height, -1, -1});
+	this->dark.clear();
+	this->dark.push_back(std::make_pair(cell, int(this->levels[cell])));
+	this->levels[cell] = 0;
+	this->Touch(cell);
+
+	for(size_t i=0; i!=this->dark.size(); ++i){
+		int c = this->dark[i].first, level = this->dark[i].second;
+		int col = c % width, row = c / width;
+		int neighbours[4] = {c - 1, c + 1, c - width, c + width};
+		bool inside[4] = {col > 0, col < width - 1, row > 0, row < height - 1};
+		for(int k=0; k!=4; ++k){
+			int n = neighbours[k];
+			if(!inside[k] or this->levels[n] == 0) continue;
+			if(this->levels[n] < level){
+				this->dark.push_back(std::make_pair(n, int(this->levels[n])));
+				this->levels[n] = 0;
+				this->Touch(n);
+			}
+			else this->lit.push_back(n);
+		}
+	}
+	// Sources inside the cleared area shine again
+	for(auto& d : this->dark){
+		int c = d.first;
+		if(this->sources[c] > this->levels[c]){
+			this->levels[c] = this->sources[c];
+			this->lit.push_back(c);
+		}
+	}
+	this->Spread();
+}
+
+void LightGrid::Upload(){
+	if(this->texture.id == 0 or this->texture.width != width or this->texture.height != height){ // First upload, or Init() on another map
+		this->texture.width = width;
+		this->texture.height = height;
+		this->texture.channel_num = 1;
+		this->texture.desc.format = GL_R8;
+		this->texture.desc.min_filter = GL_LINEAR; // Smooth light between tile centres
+		this->texture.desc.mag_filter = GL_LINEAR;
+		this->texture.desc.wrap_s = GL_CLAMP_TO_EDGE;
+		this->texture.desc.wrap_t = GL_CLAMP_TO_EDGE;
+		this->texture.Upload(&this->levels[0]);
+		this->dirty.clear();
+		return;
+	}
+
+	// Drop empty rectangles and merge the ones that overlap
+	std::vector<LightRect> rects;
+	for(LightRect& r : this->dirty){
+		if(r.col1 < r.col0) continue;
+		bool merged = false;
+		for(LightRect& m : rects){
+			if(r.col0 > m.col1 + 1 or m.col0 > r.col1 + 1 or r.row0 > m.row1 + 1 or m.row0 > r.row1 + 1) continue;
+			m.col0 = std::min(m.col0, r.col0); m.col1 = std::max(m.col1, r.col1);
+			m.row0 = std::min(m.row0, r.row0); m.row1 = std::max(m.row1, r.row1);
+			merged = true;
+			break;
+		}
+		if(!merged) rects.push_back(r);
+	}
+	this->dirty.clear();
+	if(rects.size() > MAX_UPLOAD_RECTS){
+		for(LightRect& r : rects){
+			rects[0].col0 = std::min(rects[0].col0, r.col0); rects[0].col1 = std::max(rects[0].col1, r.col1);
+			rects[0].row0 = std::min(rects[0].row0, r.row0); rects[0].row1 = std::max(rects[0].row1, r.row1);
+		}
+		rects.resize(1);
+	}
+	for(LightRect& r : rects){
+		this->texture.UploadRegion(&this->levels[0], r.col0, r.row0, r.col1 - r.col0 + 1, r.row1 - r.row0 + 1);
+	}
+}
+
+void LightGrid::Bind(Tilemap& tmap){
+	this->Upload();
+	if(!ACTIVE_SHADER) return;
+	if(this->program != ACTIVE_SHADER->program){
+		this->program = ACTIVE_SHADER->program;
+		this->lit_loc = glGetUniformLocation(program, "u_Lit");
+		this->origin_loc = glGetUniformLocation(program, "u_LightOrigin");
+		this->size_loc = glGetUniformLocation(program, "u_LightSize");
+		this->ambient_loc = glGetUniformLocation(program, "u_Ambient");
+		this->light_loc = glGetUniformLocation(program, "u_Light");
+	}
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, this->texture.id);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(this->light_loc, 2);
+	glUniform1i(this->lit_loc, 1);
+	glUniform2f(this->origin_loc, tmap.origin_x, tmap.origin_y);
+	glUniform2f(this->size_loc, tmap.width * tmap.tile_w, tmap.height * tmap.tile_h);
+	glUniform1f(this->ambient_loc, this->ambient);
+}
+
+void LightGrid::Unbind(){
+	if(ACTIVE_SHADER and ACTIVE_SHADER->program == this->program) glUniform1i(this->lit_loc, 0);
+}
+
+} // namespace Engine
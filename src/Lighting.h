@@ -0,0 +1,85 @@
+/*
+
+	Tile lighting
+
+One light level per tile, spread from light sources by a flood fill that
+loses 'falloff' levels per tile and stops at walls (walls are lit on the
+side facing the light but let none through). Overlapping lights keep the
+brightest value.
+
+	Engine::LightGrid lights;
+	lights.Init(walls, 24); // BlockBitmap of the map, levels lost per tile
+	int torch = lights.Add(cell, 255);
+	lights.Move(torch, other_cell); // Only the area the light reaches is redone
+	lights.Update(cell); // After walls.Update(tmap, cell)
+	lights.ambient = 0.3f; // Day/night, costs nothing
+
+	shader.Bind();
+	lights.Bind(tilemap); // Uploads the tiles changed since last frame
+	tilemap.Draw();
+
+The grid is kept as an R8 texture, sampled by res/fragment.shader at the
+fragment's map position. Changes are tracked as rectangles and only those
+are re-uploaded, with glTexSubImage2D.
+
+*/
+
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+#include "Engine.h"
+#include "Collision.h"
+
+namespace Engine {
+
+struct Light {
+	int cell; // -1 once removed
+	int level; // Brightness at the source, 0 to 255
+};
+
+// Inclusive rectangle of cells
+struct LightRect {
+	int col0, row0, col1, row1;
+};
+
+struct LightGrid {
+	int width, height;
+	int falloff; // Levels lost per tile
+	float ambient; // Minimum brightness, 0 to 1
+	const BlockBitmap* walls;
+	std::vector<uint8_t> levels; // Propagated light per cell
+	std::vector<uint8_t> sources; // Brightest light placed on each cell
+	std::vector<Light> lights; // Indexed by id
+	std::vector<int> lit; // Flood queue: cells to spread from
+	std::vector<std::pair<int,int>> dark; // Removal queue: cell and the level it had
+	std::vector<LightRect> dirty; // Changed since the last upload
+	Texture texture;
+	GLuint program; // Uniform locations below belong to this program
+	GLint lit_loc, origin_loc, size_loc, ambient_loc, light_loc;
+
+	LightGrid(); //Constructor
+	void Init(const BlockBitmap& walls, int falloff = 24);
+	int Add(int cell, int level); // Returns the light id
+	void Move(int id, int cell);
+	void SetLevel(int id, int level);
+	void Remove(int id);
+	void Update(int cell); // Call after walls changed at 'cell'
+	int Level(int cell); // 0 to 255, without ambient
+	void Upload(); // Sends the dirty rectangles, or the whole grid the first time
+	void Bind(Tilemap& tmap); // Shapes drawn next are lit by the grid
+	void Unbind();
+
+	void Emit(int cell, int level);
+	void Spread(); // Floods from every cell in 'lit'
+	void Darken(int cell); // Clears the light that passed through 'cell', then relights
+	void Touch(int cell); // Grows the current dirty rectangle
+	void Source(int cell); // Recomputes sources[cell] from 'lights'
+};
+
+} // namespace Engine
+
+#endif // LIGHTING_H
@@ -0,0 +1,294 @@
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "Engine.h"
+#include "Image.h"
+#include "Loader.h"
+
+
+namespace Engine {
+
+// Transparent pixel shown until the real image is uploaded
+static unsigned char PLACEHOLDER_PIXEL[4] = {0, 0, 0, 0};
+
+
+TextureLoader::TextureLoader(): workers(), uploader(), decode_queue(), upload_queue(), fence_queue() {
+	context = nullptr;
+	running = false;
+	pending = 0;
+}
+
+void TextureLoader::Init(unsigned int worker_num, GLFWwindow* share){
+	if(worker_num == 0){
+		worker_num = std::thread::hardware_concurrency();
+		worker_num = (worker_num > 1) ? worker_num - 1 : 1; // leave the render thread its core
+	}
+	this->running = true;
+
+	if(share){
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		this->context = glfwCreateWindow(1, 1, "loader", nullptr, share);
+		glfwDefaultWindowHints();
+		if(!this->context){
+			std::cerr << "[GLFW] Warning: failed to create shared context, uploading on the main thread" << std::endl;
+		} else {
+			this->uploader = std::thread(&TextureLoader::UploaderLoop, this);
+		}
+	}
+
+	for(unsigned int i=0; i!=worker_num; ++i){
+		this->workers.emplace_back(&TextureLoader::WorkerLoop, this);
+	}
+}
+
+// Must be called from the thread owning the GL context
+void TextureLoader::Load(std::shared_ptr<Texture> texture, std::string& path){
+	// The placeholder is mutable so the image can replace it under the same id
+	TextureDesc desc = texture->desc;
+	texture->filepath = path;
+	texture->width = 1; texture->height = 1; texture->channel_num = 4;
+	texture->desc = TextureDesc();
+	texture->desc.immutable = false;
+	texture->Upload(PLACEHOLDER_PIXEL);
+	texture->desc = desc;
+	texture->loaded = false;
+
+	Request req = {};
+	req.texture = texture;
+	req.path = path;
+	req.desc = desc;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->decode_queue.push_back(std::move(req));
+		this->pending++;
+	}
+	this->cv.notify_all();
+}
+
+// Fills 'buffer' with a copy of 'data'. Replaces any previous buffer object.
+// Without a shared context this uploads immediately.
+void TextureLoader::UploadBuffer(GLuint& buffer, GLenum target, const void* data, size_t bytes){
+	if(!this->context){
+		if(buffer == 0) glGenBuffers(1, &buffer);
+		glBindBuffer(target, buffer);
+		glBufferData(target, bytes, data, GL_DYNAMIC_DRAW);
+		glBindBuffer(target, 0);
+		return;
+	}
+
+	Request req = {};
+	req.buffer = &buffer;
+	req.target = target;
+	req.data.assign((const unsigned char*)data, (const unsigned char*)data + bytes);
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->upload_queue.push_back(std::move(req));
+		this->pending++;
+	}
+	this->cv.notify_all();
+}
+
+void TextureLoader::WorkerLoop(){
+	while(true){
+		Request req;
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->cv.wait(lock, [this]{ return !this->running or !this->decode_queue.empty(); });
+			if(!this->running) return;
+			req = std::move(this->decode_queue.front());
+			this->decode_queue.pop_front();
+		}
+
+		if(!req.image.Load(req.path, req.desc.indexed ? 4 : req.desc.Channels())){
+			std::cerr << "Error: failed to load image '" << req.path << "'" << std::endl;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			this->upload_queue.push_back(std::move(req));
+		}
+		this->cv.notify_all();
+		this->ready_cv.notify_all();
+	}
+}
+
+// Runs on its own thread with the shared context current
+void TextureLoader::UploaderLoop(){
+	glfwMakeContextCurrent(this->context);
+	while(true){
+		Request req;
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->cv.wait(lock, [this]{ return !this->running or !this->upload_queue.empty(); });
+			if(!this->running) break;
+			req = std::move(this->upload_queue.front());
+			this->upload_queue.pop_front();
+		}
+
+		if(req.texture and req.image.pixels){
+			// Let Texture::Upload create the object, then take ownership of its id
+			Texture staged;
+			staged.filepath = req.path;
+			staged.desc = req.desc;
+			staged.UploadImage(req.image);
+			req.uploaded = staged.id;
+			req.uploaded_palette = staged.palette_id;
+			req.immutable = staged.immutable;
+			req.desc = staged.desc; // Format changes once palettized
+			req.palette.swap(staged.palette);
+			staged.id = 0;
+			staged.palette_id = 0;
+			req.image.Free();
+		} else if(req.buffer){
+			glGenBuffers(1, &req.uploaded);
+			glBindBuffer(req.target, req.uploaded);
+			glBufferData(req.target, req.data.size(), req.data.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(req.target, 0);
+			std::vector<unsigned char>().swap(req.data);
+		}
+		req.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush(); // Make the fence visible to the main context
+
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			this->fence_queue.push_back(std::move(req));
+		}
+		this->ready_cv.notify_all();
+	}
+	glfwMakeContextCurrent(nullptr);
+}
+
+// Completes finished requests until the time budget runs out.
+// At least one request is completed per call so loading always progresses.
+int TextureLoader::Update(double budget_ms){
+	auto start = std::chrono::steady_clock::now();
+	int completed = 0;
+
+	while(true){
+		Request req;
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			if(this->context){
+				// Fences signal in submission order, so stop at the first pending one
+				if(this->fence_queue.empty()) break;
+				GLenum status = glClientWaitSync(this->fence_queue.front().fence, 0, 0);
+				if(status != GL_ALREADY_SIGNALED and status != GL_CONDITION_SATISFIED) break;
+				req = std::move(this->fence_queue.front());
+				this->fence_queue.pop_front();
+			} else {
+				if(this->upload_queue.empty()) break;
+				req = std::move(this->upload_queue.front());
+				this->upload_queue.pop_front();
+			}
+			this->pending--;
+		}
+
+		this->Complete(req);
+		completed++;
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if(elapsed.count() >= budget_ms) break;
+	}
+	return completed;
+}
+
+void TextureLoader::Complete(Request& req){
+	if(req.fence) glDeleteSync(req.fence);
+
+	if(req.buffer){
+		if(*req.buffer != 0) glDeleteBuffers(1, req.buffer);
+		*req.buffer = req.uploaded;
+		return;
+	}
+
+	Texture* tex = req.texture.get();
+	if(req.uploaded){
+		// Swap the placeholder for the object uploaded on the shared context
+		glDeleteTextures(1, &tex->id);
+		glDeleteTextures(1, &tex->palette_id);
+		tex->id = req.uploaded;
+		tex->palette_id = req.uploaded_palette;
+		tex->palette.swap(req.palette);
+		tex->immutable = req.immutable;
+		tex->desc = req.desc;
+		tex->width = req.image.width;
+		tex->height = req.image.height;
+		tex->channel_num = req.desc.Channels();
+		tex->loaded = true;
+		TEXTURE_MEMORY.Track(tex, tex->GpuBytes());
+	} else if(req.image.pixels){
+		tex->UploadImage(req.image);
+		req.image.Free();
+	}
+}
+
+void TextureLoader::Finish(){
+	while(this->Busy()){
+		GLsync fence = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			if(this->context){
+				this->ready_cv.wait(lock, [this]{ return !this->fence_queue.empty(); });
+				fence = this->fence_queue.front().fence;
+			} else {
+				this->ready_cv.wait(lock, [this]{ return !this->upload_queue.empty(); });
+			}
+		}
+		// Only this thread pops fences, so 'fence' stays valid while unlocked
+		if(fence) glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		this->Update(1e9);
+	}
+}
+
+bool TextureLoader::Busy(){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->pending > 0;
+}
+
+// Stops the threads and frees what was never completed. Needs the GL
+// context, so call it before glfwTerminate(); the destructor calls it too.
+void TextureLoader::Shutdown(){
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->running = false;
+	}
+	this->cv.notify_all();
+	for(auto& w : this->workers) w.join();
+	this->workers.clear();
+	if(this->uploader.joinable()) this->uploader.join();
+
+	// Decoded but never uploaded
+	for(auto& req : this->upload_queue) req.image.Free();
+	// Uploaded but never swapped in
+	for(auto& req : this->fence_queue){
+		glDeleteSync(req.fence);
+		if(req.texture){
+			glDeleteTextures(1, &req.uploaded);
+			glDeleteTextures(1, &req.uploaded_palette);
+		}
+		else glDeleteBuffers(1, &req.uploaded);
+	}
+	this->decode_queue.clear();
+	this->upload_queue.clear();
+	this->fence_queue.clear();
+	this->pending = 0;
+	if(this->context) glfwDestroyWindow(this->context);
+	this->context = nullptr;
+}
+
+TextureLoader::~TextureLoader(){
+	this->Shutdown();
+}
+
+} // namespace Engine
@@ -0,0 +1,99 @@
+/*
+
+	Asynchronous texture loading
+
+Image files are decoded by a pool of worker threads, while the GL upload
+is completed on the render thread by calling Update() once per frame.
+
+	Engine::TextureLoader loader;
+	loader.Init();
+	loader.Load(player.texture, path); // returns immediately
+	while(...){
+		loader.Update(2.0); // upload for at most 2 ms this frame
+		...
+	}
+	loader.Shutdown();
+	glfwTerminate();
+
+Textures handed to Load() receive a 1x1 placeholder straight away and keep
+the same GL id once the real image arrives. The request holds a reference
+to its texture until it completes, so callers may drop their handles
+meanwhile.
+
+Shared context mode
+
+Passing the main window to Init() creates a hidden window whose context
+shares objects with it. An uploader thread owns that context and performs
+glTexImage2D, glGenerateMipmap and glBufferData there, fencing each upload.
+Update() then only polls the fences and swaps the finished objects in, so
+the render thread never pays for the upload itself. In this mode the
+placeholder id is replaced by the uploaded one when the fence signals.
+
+*/
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+#include "Engine.h"
+#include "Image.h"
+
+namespace Engine {
+
+struct TextureLoader {
+
+	// Texture or buffer making its way through decode, upload and fence
+	struct Request {
+		std::shared_ptr<Texture> texture; // Set for texture requests, kept alive until completed
+		std::string path;
+		TextureDesc desc;
+		Image image; // desc.Channels() per pixel
+		GLuint* buffer; // Set for buffer requests
+		GLenum target;
+		std::vector<unsigned char> data; // Buffer contents
+		GLuint uploaded; // Object created on the shared context
+		GLuint uploaded_palette;
+		std::vector<unsigned char> palette;
+		bool immutable;
+		GLsync fence;
+	};
+
+	std::vector<std::thread> workers;
+	std::thread uploader; // Only in shared context mode
+	GLFWwindow* context; // Hidden window sharing objects with the main one
+	std::deque<Request> decode_queue; // Guarded by mtx
+	std::deque<Request> upload_queue; // Guarded by mtx
+	std::deque<Request> fence_queue; // Guarded by mtx
+	std::mutex mtx;
+	std::condition_variable cv; // Wakes workers and uploader
+	std::condition_variable ready_cv; // Signals a decoded image or new fence
+	bool running;
+	int pending; // Requests not yet completed
+
+	TextureLoader(); //Constructor
+	// 0 workers picks one per spare core. Passing the main window enables
+	// the shared context uploader; must be called from the main thread.
+	void Init(unsigned int worker_num = 0, GLFWwindow* share = nullptr);
+	void Load(std::shared_ptr<Texture> texture, std::string& path);
+	void UploadBuffer(GLuint& buffer, GLenum target, const void* data, size_t bytes);
+	int Update(double budget_ms = 2.0); // Completes finished requests, returns count
+	void Finish(); // Blocks until every pending request is completed
+	bool Busy();
+	void Shutdown(); // Before glfwTerminate(). Again is a no-op.
+	~TextureLoader(); //Destructor
+
+	void WorkerLoop();
+	void UploaderLoop();
+	void Complete(Request& req); // Main thread side of a finished request
+};
+
+} // namespace Engine
+
+#endif // LOADER_H
@@ -0,0 +1,95 @@
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+
+#ifndef __WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "Pack.h"
+
+
+namespace Engine {
+
+Pack ASSET_PACK;
+
+
+Pack::Pack(): entries() {
+	mapping = nullptr;
+	mapping_size = 0;
+}
+
+// Returns false if the pack is missing or malformed, in which case
+// assets keep being read from individual files.
+bool Pack::Open(const std::string& path){
+	this->Close();
+#ifdef __WIN32
+	return false;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0 or size_t(st.st_size) < sizeof(PackHeader)){
+		close(fd);
+		return false;
+	}
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) return false;
+	// Pull the whole file in with one sequential read
+	madvise(map, st.st_size, MADV_WILLNEED);
+
+	this->mapping = map;
+	this->mapping_size = st.st_size;
+
+	const PackHeader* hdr = static_cast<const PackHeader*>(map);
+	if(std::memcmp(hdr->magic, PACK_MAGIC, 4) != 0 or hdr->version != PACK_VERSION
+		or sizeof(PackHeader) + uint64_t(hdr->entry_num) * sizeof(PackEntry) > this->mapping_size){
+		std::cerr << "Error: invalid asset pack '" << path << "'" << std::endl;
+		this->Close();
+		return false;
+	}
+
+	const PackEntry* toc = reinterpret_cast<const PackEntry*>(hdr + 1);
+	for(uint32_t i=0; i!=hdr->entry_num; ++i){
+		const PackEntry& e = toc[i];
+		if(e.offset + e.size > this->mapping_size or e.name[sizeof(e.name)-1] != '\0'){
+			std::cerr << "Error: corrupt entry in asset pack '" << path << "'" << std::endl;
+			this->Close();
+			return false;
+		}
+		this->entries[e.name] = &e;
+	}
+	return true;
+#endif
+}
+
+// Points 'data' at the stored bytes of 'name' without copying them
+bool Pack::Find(const std::string& name, const unsigned char*& data, size_t& size){
+	auto it = this->entries.find(name);
+	if(it == this->entries.end()) return false;
+	data = static_cast<const unsigned char*>(this->mapping) + it->second->offset;
+	size = it->second->size;
+	return true;
+}
+
+void Pack::Close(){
+#ifndef __WIN32
+	if(this->mapping) munmap(this->mapping, this->mapping_size);
+#endif
+	this->mapping = nullptr;
+	this->mapping_size = 0;
+	this->entries.clear();
+}
+
+Pack::~Pack(){
+	this->Close();
+}
+
+} // namespace Engine
@@ -0,0 +1,59 @@
+/*
+
+	Asset pack
+
+A single file holding the contents of res/, built by asset-packer:
+
+	[PackHeader][PackEntry x entry_num][blob][blob]...
+
+Blobs start on PACK_ALIGN boundaries and are stored unmodified. Entry names
+are the paths the engine would otherwise open (e.g. "res/vertex.shader"), so
+FileReadLines, Image::Load and Tilemap::Read look them up in ASSET_PACK first
+and fall back to the filesystem. The pack is mapped into memory once and
+blobs are read in place.
+
+*/
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+namespace Engine {
+
+const char PACK_MAGIC[4] = {'R', 'P', 'G', 'P'};
+const uint32_t PACK_VERSION = 1;
+const uint64_t PACK_ALIGN = 64;
+
+struct PackHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t entry_num;
+	uint32_t reserved;
+};
+
+struct PackEntry {
+	char name[112]; // Null terminated
+	uint64_t offset; // From the start of the file
+	uint64_t size;
+};
+
+struct Pack {
+	void* mapping;
+	size_t mapping_size;
+	std::unordered_map<std::string, const PackEntry*> entries;
+
+	Pack(); //Constructor
+	bool Open(const std::string& path);
+	bool Find(const std::string& name, const unsigned char*& data, size_t& size);
+	void Close();
+	~Pack(); //Destructor
+};
+
+extern Pack ASSET_PACK;
+
+} // namespace Engine
+
+#endif // PACK_H
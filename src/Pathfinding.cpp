@@ -0,0 +1,975 @@
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <iostream>
+
+#include "Engine.h"
+#include "Collision.h"
+#include "Pathfinding.h"
+
+
+namespace Engine {
+
+static const float SQRT2 = 1.41421356f;
+static const int DIR_X[8] = {1, -1, 0, 0, 1, -1, 1, -1};
+static const int DIR_Y[8] = {0, 0, 1, -1, 1, 1, -1, -1};
+
+// Min-heap on f, deeper nodes first on ties. A functor so the heap
+// algorithms can inline it.
+struct OpenAfter {
+	bool operator()(const PathOpen& a, const PathOpen& b) const {
+		return a.f > b.f or (a.f == b.f and a.g < b.g);
+	}
+};
+
+
+// ============== PATHFINDER METHODS
+
+Pathfinder::Pathfinder(): jumps(), nodes(), open() {
+	blocked = nullptr; width = 0; height = 0;
+	diagonal = true; mode = PATH_ASTAR; generation = 0; expanded = 0;
+}
+
+void Pathfinder::Init(const BlockBitmap& blocked, bool diagonal, PathMode mode){
+	this->blocked = &blocked;
+	this->width = blocked.width;
+	this->height = blocked.height;
+	this->diagonal = diagonal;
+	this->mode = mode;
+	this->nodes.assign(size_t(width) * height, PathNode{0, false, 0, -1, -1});
+	this->generation = 0;
+	this->ClearBounds();
+
+	this->jumps.clear();
+	if(mode == PATH_JPS_PLUS){
+		this->jumps.resize(size_t(width) * height * 4);
+		for(int r=0; r!=height; ++r) this->BuildJumpRow(r);
+		for(int c=0; c!=width; ++c) this->BuildJumpColumn(c);
+	}
+}
+
+// Jump distances only depend on the cell's row and column and the ones
+// next to them, so only those are redone
+void Pathfinder::Update(int cell){
+	if(this->jumps.empty()) return;
+	int col = cell % width, row = cell / width;
+	for(int r=std::max(row - 1, 0); r<=std::min(row + 1, height - 1); ++r) this->BuildJumpRow(r);
+	for(int c=std::max(col - 1, 0); c<=std::min(col + 1, width - 1); ++c) this->BuildJumpColumn(c);
+}
+
+void Pathfinder::SetBounds(int col0, int row0, int col1, int row1){
+	this->min_col = std::max(col0, 0); this->min_row = std::max(row0, 0);
+	this->max_col = std::min(col1, width - 1); this->max_row = std::min(row1, height - 1);
+}
+
+void Pathfinder::ClearBounds(){
+	this->SetBounds(0, 0, width - 1, height - 1);
+}
+
+bool Pathfinder::Free(int col, int row){
+	// BlockBitmap::Get inlined: this is the innermost call of every search
+	return col >= min_col and col <= max_col and row >= min_row and row <= max_row
+	   and !((this->blocked->bits[size_t(row) * this->blocked->words + (col >> 6)] >> (col & 63)) & 1);
+}
+
+// Octile distance, or Manhattan without diagonals
+float Pathfinder::Heuristic(int col, int row, int goal_col, int goal_row){
+	int dx = std::abs(col - goal_col), dy = std::abs(row - goal_row);
+	if(!this->diagonal) return float(dx + dy);
+	return float(dx + dy) + (SQRT2 - 2.0f) * float(std::min(dx, dy));
+}
+
+PathNode& Pathfinder::Visit(int cell){
+	PathNode& node = this->nodes[cell];
+	if(node.generation != this->generation){
+		node.generation = this->generation;
+		node.closed = false;
+		node.g = INFINITY;
+		node.parent = -1;
+		node.open = -1;
+	}
+	return node;
+}
+
+void Pathfinder::NextGeneration(){
+	this->generation++;
+	// Stamps wrapped around: old nodes could pass as current, so clear once
+	if(this->generation == 0){
+		for(PathNode& node : this->nodes) node.generation = 0;
+		this->generation = 1;
+	}
+	this->open.clear();
+	this->expanded = 0;
+}
+
+// Three blocked bits of a row, columns col-1 to col+1 in bits 0 to 2
+static inline unsigned Row3(const uint64_t* row, int col){
+	int c = col - 1, shift = c & 63;
+	uint64_t bits = row[c >> 6] >> shift;
+	if(shift > 61) bits |= row[(c >> 6) + 1] << (64 - shift);
+	return unsigned(bits) & 7;
+}
+
+// Away from the search bounds the 3x3 block is read straight from the
+// bitmap words, instead of one bounds-checked Free() per neighbour
+unsigned Pathfinder::Moves(int col, int row){
+	unsigned free = 0;
+	if(col > min_col and col < max_col and row > min_row and row < max_row){
+		const uint64_t* bits = &this->blocked->bits[size_t(row) * this->blocked->words];
+		size_t stride = this->blocked->words;
+		unsigned below = ~Row3(bits - stride, col), middle = ~Row3(bits, col), above = ~Row3(bits + stride, col);
+		free = ((middle >> 2) & 1) | ((middle & 1) << 1) | ((above & 2) << 1) | ((below & 2) << 2)
+		     | ((above & 4) << 2) | ((above & 1) << 5) | ((below & 4) << 4) | ((below & 1) << 7);
+	} else {
+		for(int d=0; d!=8; ++d) free |= unsigned(this->Free(col + DIR_X[d], row + DIR_Y[d])) << d;
+	}
+	if(!this->diagonal) return free & 0x0f;
+	// Diagonals need both side cells free, as DIR_X/DIR_Y list them
+	unsigned right = free & 1, left = (free >> 1) & 1, up = (free >> 2) & 1, down = (free >> 3) & 1;
+	unsigned corners = ((right & up) << 4) | ((left & up) << 5) | ((right & down) << 6) | ((left & down) << 7);
+	return free & (0x0f | corners);
+}
+
+void Pathfinder::Push(float f, float g, int cell){
+	PathNode& node = this->nodes[cell];
+	if(node.open == -1){
+		node.open = int(this->open.size());
+		this->open.push_back({f, g, cell});
+	} else {
+		// Only ever called with a shorter cost, so the entry can only rise
+		this->open[node.open].f = f;
+		this->open[node.open].g = g;
+	}
+	this->SiftUp(node.open);
+}
+
+PathOpen Pathfinder::Pop(){
+	PathOpen top = this->open[0];
+	this->nodes[top.cell].open = -1;
+	PathOpen last = this->open.back();
+	this->open.pop_back();
+	if(!this->open.empty()){
+		this->open[0] = last;
+		this->nodes[last.cell].open = 0;
+		this->SiftDown(0);
+	}
+	return top;
+}
+
+void Pathfinder::SiftUp(int i){
+	PathOpen entry = this->open[i];
+	while(i > 0){
+		int parent = (i - 1) / 2;
+		if(!OpenAfter()(this->open[parent], entry)) break;
+		this->open[i] = this->open[parent];
+		this->nodes[this->open[i].cell].open = i;
+		i = parent;
+	}
+	this->open[i] = entry;
+	this->nodes[entry.cell].open = i;
+}
+
+void Pathfinder::SiftDown(int i){
+	PathOpen entry = this->open[i];
+	int size = int(this->open.size());
+	while(true){
+		int child = 2*i + 1;
+		if(child >= size) break;
+		if(child + 1 < size and OpenAfter()(this->open[child], this->open[child + 1])) child++;
+		if(!OpenAfter()(entry, this->open[child])) break;
+		this->open[i] = this->open[child];
+		this->nodes[this->open[i].cell].open = i;
+		i = child;
+	}
+	this->open[i] = entry;
+	this->nodes[entry.cell].open = i;
+}
+
+// Walks back the parents, filling in the straight or diagonal runs that
+// JPS jumps over
+void Pathfinder::Trace(int goal, std::vector<int>& path){
+	for(int cell = goal; cell != -1; cell = this->nodes[cell].parent){
+		int parent = this->nodes[cell].parent;
+		path.push_back(cell);
+		if(parent == -1) break;
+		int dx = (parent % width > cell % width) - (parent % width < cell % width);
+		int dy = (parent / width > cell / width) - (parent / width < cell / width);
+		for(int c = cell + dx + dy*width; c != parent; c += dx + dy*width) path.push_back(c);
+	}
+	std::reverse(path.begin(), path.end());
+}
+
+bool Pathfinder::FindPath(int start, int goal, std::vector<int>& path){
+	path.clear();
+	int cells = width * height;
+	if(start < 0 or start >= cells or goal < 0 or goal >= cells) return false;
+	if(!this->Free(start % width, start / width) or !this->Free(goal % width, goal / width)) return false;
+
+	this->NextGeneration();
+	this->Visit(start).g = 0;
+	this->Push(this->Heuristic(start % width, start / width, goal % width, goal / width), 0, start);
+	if(this->mode == PATH_ASTAR or !this->diagonal) this->SearchAStar(goal);
+	else this->SearchJPS(goal);
+
+	if(!this->Visit(goal).closed) return false;
+	this->Trace(goal, path);
+	return true;
+}
+
+void Pathfinder::Flood(int start){
+	this->Flood(&start, 1);
+}
+
+void Pathfinder::Flood(const int* starts, int num){
+	this->NextGeneration();
+	for(int i=0; i!=num; ++i){
+		if(!this->Free(starts[i] % width, starts[i] / width)) continue;
+		this->Visit(starts[i]).g = 0;
+		this->Push(0, 0, starts[i]);
+	}
+	this->SearchAStar(-1);
+}
+
+float Pathfinder::Cost(int cell){
+	PathNode& node = this->nodes[cell];
+	return (node.generation == this->generation and node.closed) ? node.g : INFINITY;
+}
+
+// A negative goal floods the whole area, without a heuristic
+void Pathfinder::SearchAStar(int goal){
+	bool flood = goal < 0;
+	int goal_col = goal % width, goal_row = goal / width;
+	int dirs = this->diagonal ? 8 : 4;
+
+	while(!this->open.empty()){
+		PathOpen top = this->Pop();
+		PathNode& node = this->nodes[top.cell];
+		node.closed = true;
+		this->expanded++;
+		if(top.cell == goal) return;
+
+		int col = top.cell % width, row = top.cell / width;
+		unsigned moves = this->Moves(col, row);
+		for(int d=0; d!=dirs; ++d){
+			if(!(moves >> d & 1)) continue;
+			int nc = col + DIR_X[d], nr = row + DIR_Y[d];
+			int next = nr*width + nc;
+			PathNode& child = this->Visit(next);
+			float g = node.g + ((d >= 4) ? SQRT2 : 1.0f);
+			if(child.closed or g >= child.g) continue;
+			child.g = g;
+			child.parent = top.cell;
+			this->Push(g + (flood ? 0 : this->Heuristic(nc, nr, goal_col, goal_row)), g, next);
+		}
+	}
+}
+
+
+// ============== JUMP POINT SEARCH
+
+// A straight move reaching this cell has a neighbour that is only reached
+// optimally through it, because a wall hides it from the previous cell
+bool Pathfinder::Forced(int col, int row, int dx, int dy){
+	if(dx != 0){
+		return (this->Free(col, row - 1) and !this->Free(col - dx, row - 1))
+		    or (this->Free(col, row + 1) and !this->Free(col - dx, row + 1));
+	}
+	return (this->Free(col - 1, row) and !this->Free(col - 1, row - dy))
+	    or (this->Free(col + 1, row) and !this->Free(col + 1, row - dy));
+}
+
+// First jump point (or the goal) straight from the cell, not counting
+// itself. -1 if a wall comes first.
+int Pathfinder::JumpStraight(int col, int row, int dx, int dy, int goal){
+	if(!this->jumps.empty()){
+		int dir = (dx > 0) ? 0 : (dx < 0) ? 1 : (dy > 0) ? 2 : 3;
+		int dist = this->jumps[size_t(row*width + col) * 4 + dir];
+		int reach = (dist > 0) ? dist : -dist;
+		int gc = goal % width, gr = goal / width;
+		int ahead = (dx != 0) ? (gc - col) * dx : (gr - row) * dy;
+		bool in_line = (dx != 0) ? gr == row : gc == col;
+		if(in_line and ahead > 0 and ahead <= reach) return goal;
+		return (dist > 0) ? (row + dy*dist)*width + col + dx*dist : -1;
+	}
+
+	if(dy == 0) return this->ScanRow(col, row, dx, goal);
+	return this->ScanColumn(col, row, dy, goal);
+}
+
+uint64_t Pathfinder::BlockedWord(int row, int word){
+	if(row < min_row or row > max_row or word < 0 or word >= this->blocked->words) return ~uint64_t(0);
+	uint64_t bits = this->blocked->bits[size_t(row) * this->blocked->words + word];
+	int first = word*64, last = first + 63;
+	if(min_col > last or max_col < first) return ~uint64_t(0);
+	if(min_col > first) bits |= ~(~uint64_t(0) << (min_col - first));
+	if(max_col < last) bits |= ~(~uint64_t(0) >> (last - max_col));
+	return bits;
+}
+
+// A cell ends the run if it is blocked or has a forced neighbour: free
+// above (below) while the cell behind it is blocked, which for a whole
+// word is the blocked bits shifted one cell along the move
+int Pathfinder::ScanRow(int col, int row, int dx, int goal){
+	int goal_col = (goal >= 0 and goal / width == row) ? goal % width : -1;
+	int start = col + dx;
+	for(int word = start >> 6; ; word += dx){
+		uint64_t above = this->BlockedWord(row + 1, word), below = this->BlockedWord(row - 1, word);
+		uint64_t behind_above, behind_below;
+		if(dx > 0){
+			behind_above = (above << 1) | (this->BlockedWord(row + 1, word - 1) >> 63);
+			behind_below = (below << 1) | (this->BlockedWord(row - 1, word - 1) >> 63);
+		} else {
+			behind_above = (above >> 1) | (this->BlockedWord(row + 1, word + 1) << 63);
+			behind_below = (below >> 1) | (this->BlockedWord(row - 1, word + 1) << 63);
+		}
+		uint64_t walls = this->BlockedWord(row, word);
+		uint64_t stops = walls | (~above & behind_above) | (~below & behind_below);
+		if(goal_col != -1 and goal_col >> 6 == word) stops |= uint64_t(1) << (goal_col & 63);
+		// Only cells ahead of the start
+		if(word == start >> 6) stops &= (dx > 0) ? ~uint64_t(0) << (start & 63) : ~uint64_t(0) >> (63 - (start & 63));
+		if(!stops) continue;
+
+		int bit = (dx > 0) ? __builtin_ctzll(stops) : 63 - __builtin_clzll(stops);
+		if((walls >> bit) & 1) return -1;
+		return row*width + word*64 + bit;
+	}
+}
+
+// Keeps the three cells of the previous row: a side cell is forced when
+// it is free and the one behind it was blocked
+int Pathfinder::ScanColumn(int col, int row, int dy, int goal){
+	if(col <= min_col or col >= max_col){
+		// Next to the bounds, where the 3-cell reads would leave the area
+		while(true){
+			row += dy;
+			if(!this->Free(col, row)) return -1;
+			int cell = row*width + col;
+			if(cell == goal or this->Forced(col, row, 0, dy)) return cell;
+		}
+	}
+	size_t stride = this->blocked->words;
+	const uint64_t* bits = this->blocked->bits.data();
+	unsigned behind = Row3(bits + size_t(row) * stride, col);
+	while(true){
+		row += dy;
+		if(row < min_row or row > max_row) return -1;
+		unsigned cells = Row3(bits + size_t(row) * stride, col);
+		if(cells & 2) return -1;
+		int cell = row*width + col;
+		if(cell == goal or (~cells & behind & 5)) return cell;
+		behind = cells;
+	}
+}
+
+int Pathfinder::Jump(int col, int row, int dx, int dy, int goal){
+	if(dx == 0 or dy == 0) return this->JumpStraight(col, row, dx, dy, goal);
+
+	// Diagonal: stop where either straight run from the cell finds something
+	while(true){
+		if(!(this->Free(col + dx, row) and this->Free(col, row + dy) and this->Free(col + dx, row + dy))) return -1;
+		col += dx; row += dy;
+		int cell = row*width + col;
+		if(cell == goal) return cell;
+		if(this->JumpStraight(col, row, dx, 0, goal) != -1 or this->JumpStraight(col, row, 0, dy, goal) != -1) return cell;
+	}
+}
+
+void Pathfinder::SearchJPS(int goal){
+	int goal_col = goal % width, goal_row = goal / width;
+
+	while(!this->open.empty()){
+		PathOpen top = this->Pop();
+		PathNode& node = this->nodes[top.cell];
+		if(node.closed) continue;
+		node.closed = true;
+		this->expanded++;
+		if(top.cell == goal) return;
+
+		int col = top.cell % width, row = top.cell / width;
+		// Directions worth scanning, pruned by the direction we arrived from
+		int dirs_x[8], dirs_y[8], dir_num = 0;
+		auto add = [&](int dx, int dy){ dirs_x[dir_num] = dx; dirs_y[dir_num] = dy; dir_num++; };
+		if(node.parent == -1){
+			for(int d=0; d!=8; ++d) add(DIR_X[d], DIR_Y[d]);
+		}
+		else{
+			int pc = node.parent % width, pr = node.parent / width;
+			int dx = (col > pc) - (col < pc), dy = (row > pr) - (row < pr);
+			if(dx != 0 and dy != 0){
+				add(dx, 0); add(0, dy); add(dx, dy);
+			}
+			else if(dx != 0){
+				add(dx, 0); add(dx, 1); add(dx, -1); add(0, 1); add(0, -1);
+			}
+			else{
+				add(0, dy); add(1, dy); add(-1, dy); add(1, 0); add(-1, 0);
+			}
+		}
+
+		for(int d=0; d!=dir_num; ++d){
+			int jump = this->Jump(col, row, dirs_x[d], dirs_y[d], goal);
+			if(jump == -1) continue;
+
+			int jc = jump % width, jr = jump / width;
+			PathNode& child = this->Visit(jump);
+			int ax = std::abs(jc - col), ay = std::abs(jr - row);
+			float g = node.g + float(std::max(ax, ay) - std::min(ax, ay)) + SQRT2 * float(std::min(ax, ay));
+			if(child.closed or g >= child.g) continue;
+			child.g = g;
+			child.parent = top.cell;
+			this->Push(g + this->Heuristic(jc, jr, goal_col, goal_row), g, jump);
+		}
+	}
+}
+
+
+// ============== JPS+ DISTANCES
+
+// Each entry builds on its neighbour's one step further along, so every
+// run is filled starting from its far end
+void Pathfinder::BuildJumpRow(int row){
+	for(int dx : {1, -1}){
+		int dir = (dx > 0) ? 0 : 1;
+		int first = (dx > 0) ? width - 1 : 0;
+		for(int col = first; col >= 0 and col < width; col -= dx){
+			int16_t& dist = this->jumps[size_t(row*width + col) * 4 + dir];
+			int next = col + dx;
+			if(!this->Free(next, row)) dist = 0;
+			else if(this->Forced(next, row, dx, 0)) dist = 1;
+			else{
+				int16_t ahead = this->jumps[size_t(row*width + next) * 4 + dir];
+				dist = (ahead > 0) ? ahead + 1 : ahead - 1;
+			}
+		}
+	}
+}
+
+void Pathfinder::BuildJumpColumn(int col){
+	for(int dy : {1, -1}){
+		int dir = (dy > 0) ? 2 : 3;
+		int first = (dy > 0) ? height - 1 : 0;
+		for(int row = first; row >= 0 and row < height; row -= dy){
+			int16_t& dist = this->jumps[size_t(row*width + col) * 4 + dir];
+			int next = row + dy;
+			if(!this->Free(col, next)) dist = 0;
+			else if(this->Forced(col, next, 0, dy)) dist = 1;
+			else{
+				int16_t ahead = this->jumps[size_t(next*width + col) * 4 + dir];
+				dist = (ahead > 0) ? ahead + 1 : ahead - 1;
+			}
+		}
+	}
+}
+
+// ============== PATH HIERARCHY METHODS
+
+PathCluster::PathCluster(): nodes(), links(), costs() {
+	dirty = true;
+}
+
+PathHierarchy::PathHierarchy(): clusters(), borders_x(), borders_y(), local(), graph() {
+	blocked = nullptr; width = 0; height = 0;
+	cluster_size = 16; clusters_x = 0; clusters_y = 0; expanded = 0;
+}
+
+void PathHierarchy::Init(BlockBitmap& blocked, int cluster_size){
+	this->blocked = &blocked;
+	this->width = blocked.width;
+	this->height = blocked.height;
+	this->cluster_size = cluster_size;
+	this->clusters_x = (width + cluster_size - 1) / cluster_size;
+	this->clusters_y = (height + cluster_size - 1) / cluster_size;
+	this->local.Init(blocked);
+	this->graph.Init(blocked);
+
+	int num = clusters_x * clusters_y;
+	this->clusters.assign(num, PathCluster());
+	this->borders_x.assign(num, std::vector<std::pair<int,int>>());
+	this->borders_y.assign(num, std::vector<std::pair<int,int>>());
+	for(int k=0; k!=num; ++k){
+		if(k % clusters_x != clusters_x - 1) this->BuildBorder(k, true);
+		if(k / clusters_x != clusters_y - 1) this->BuildBorder(k, false);
+	}
+	// Cluster costs are computed by the first query that needs them
+}
+
+int PathHierarchy::ClusterOf(int cell){
+	return (cell / width / cluster_size) * clusters_x + (cell % width) / cluster_size;
+}
+
+void PathHierarchy::Confine(int cluster){
+	int col = (cluster % clusters_x) * cluster_size, row = (cluster / clusters_x) * cluster_size;
+	this->local.SetBounds(col, row, col + cluster_size - 1, row + cluster_size - 1);
+}
+
+// Every run of open cell pairs facing each other across the border is an
+// entrance, crossed in its middle, or at both ends when it is long
+void PathHierarchy::BuildBorder(int cluster, bool along_x){
+	std::vector<std::pair<int,int>>& border = along_x ? this->borders_x[cluster] : this->borders_y[cluster];
+	border.clear();
+	int cx = cluster % clusters_x, cy = cluster / clusters_x;
+	int len = along_x ? std::min(cluster_size, height - cy*cluster_size) : std::min(cluster_size, width - cx*cluster_size);
+	// Cell i of the border on this side, and the step to the other side
+	auto cell = [&](int i){
+		return along_x ? (cy*cluster_size + i)*width + (cx + 1)*cluster_size - 1
+		               : ((cy + 1)*cluster_size - 1)*width + cx*cluster_size + i;
+	};
+	int across = along_x ? 1 : width;
+	auto open = [&](int c){ return !this->blocked->Get(c % width, c / width); };
+
+	for(int i=0; i<len; ){
+		if(!(open(cell(i)) and open(cell(i) + across))){ i++; continue; }
+		int end = i;
+		while(end + 1 < len and open(cell(end + 1)) and open(cell(end + 1) + across)) end++;
+		if(end - i + 1 < 6){
+			int mid = (i + end) / 2;
+			border.push_back(std::make_pair(cell(mid), cell(mid) + across));
+		}
+		else{
+			border.push_back(std::make_pair(cell(i), cell(i) + across));
+			border.push_back(std::make_pair(cell(end), cell(end) + across));
+		}
+		i = end + 1;
+	}
+}
+
+void PathHierarchy::BuildCluster(int cluster){
+	PathCluster& cl = this->clusters[cluster];
+	cl.nodes.clear();
+	cl.links.clear();
+	auto add = [&](int node, int partner){
+		int index = int(std::find(cl.nodes.begin(), cl.nodes.end(), node) - cl.nodes.begin());
+		if(index == int(cl.nodes.size())) cl.nodes.push_back(node);
+		cl.links.push_back(std::make_pair(index, partner));
+	};
+	int cx = cluster % clusters_x, cy = cluster / clusters_x;
+	if(cx > 0) for(auto& e : this->borders_x[cluster - 1]) add(e.second, e.first);
+	if(cx < clusters_x - 1) for(auto& e : this->borders_x[cluster]) add(e.first, e.second);
+	if(cy > 0) for(auto& e : this->borders_y[cluster - clusters_x]) add(e.second, e.first);
+	if(cy < clusters_y - 1) for(auto& e : this->borders_y[cluster]) add(e.first, e.second);
+
+	int n = int(cl.nodes.size());
+	cl.costs.assign(n*n, INFINITY);
+	this->Confine(cluster);
+	for(int i=0; i!=n; ++i){
+		this->local.Flood(cl.nodes[i]);
+		for(int j=0; j!=n; ++j) cl.costs[i*n + j] = this->local.Cost(cl.nodes[j]);
+	}
+	cl.dirty = false;
+}
+
+void PathHierarchy::Update(int cell){
+	int cluster = this->ClusterOf(cell);
+	int col = (cell % width) % cluster_size, row = (cell / width) % cluster_size;
+	int cx = cluster % clusters_x, cy = cluster / clusters_x;
+	this->clusters[cluster].dirty = true;
+
+	// On a border, its entrances change for the neighbour too
+	if(col == 0 and cx > 0){
+		this->BuildBorder(cluster - 1, true);
+		this->clusters[cluster - 1].dirty = true;
+	}
+	if(col == cluster_size - 1 and cx < clusters_x - 1){
+		this->BuildBorder(cluster, true);
+		this->clusters[cluster + 1].dirty = true;
+	}
+	if(row == 0 and cy > 0){
+		this->BuildBorder(cluster - clusters_x, false);
+		this->clusters[cluster - clusters_x].dirty = true;
+	}
+	if(row == cluster_size - 1 and cy < clusters_y - 1){
+		this->BuildBorder(cluster, false);
+		this->clusters[cluster + clusters_x].dirty = true;
+	}
+}
+
+bool PathHierarchy::LocalPath(int cluster, int from, int to, std::vector<int>& path){
+	std::vector<int> segment;
+	this->Confine(cluster);
+	bool found = this->local.FindPath(from, to, segment);
+	this->expanded += this->local.expanded;
+	if(found) path.insert(path.end(), segment.begin() + 1, segment.end());
+	return found;
+}
+
+bool PathHierarchy::FindPath(int start, int goal, std::vector<int>& path){
+	path.clear();
+	this->expanded = 0;
+	int cells = width * height;
+	if(start < 0 or start >= cells or goal < 0 or goal >= cells) return false;
+	if(this->blocked->Get(start % width, start / width) or this->blocked->Get(goal % width, goal / width)) return false;
+	for(int k=0; k!=int(this->clusters.size()); ++k){
+		if(this->clusters[k].dirty) this->BuildCluster(k);
+	}
+
+	int sc = this->ClusterOf(start), gc = this->ClusterOf(goal);
+	path.push_back(start);
+	if(sc == gc and this->LocalPath(sc, start, goal, path)) return true;
+
+	// Short hops into a neighbouring cluster: going through an entrance
+	// could be a long detour, search both clusters directly instead
+	int scx = sc % clusters_x, scy = sc / clusters_x, gcx = gc % clusters_x, gcy = gc / clusters_x;
+	if(sc != gc and std::abs(scx - gcx) <= 1 and std::abs(scy - gcy) <= 1){
+		std::vector<int> segment;
+		this->local.SetBounds(std::min(scx, gcx) * cluster_size, std::min(scy, gcy) * cluster_size,
+		                      (std::max(scx, gcx) + 1) * cluster_size - 1, (std::max(scy, gcy) + 1) * cluster_size - 1);
+		bool found = this->local.FindPath(start, goal, segment);
+		this->expanded += this->local.expanded;
+		if(found){
+			path = segment;
+			return true;
+		}
+	}
+
+	// Costs from the start and to the goal for the entrances of their clusters
+	PathCluster& scl = this->clusters[sc];
+	PathCluster& gcl = this->clusters[gc];
+	std::vector<float> start_costs(scl.nodes.size()), goal_costs(gcl.nodes.size());
+	this->Confine(sc);
+	this->local.Flood(start);
+	for(size_t j=0; j!=scl.nodes.size(); ++j) start_costs[j] = this->local.Cost(scl.nodes[j]);
+	this->Confine(gc);
+	this->local.Flood(goal);
+	for(size_t j=0; j!=gcl.nodes.size(); ++j) goal_costs[j] = this->local.Cost(gcl.nodes[j]);
+
+	// A* over the entrances, with the start and goal cells as extra nodes
+	Pathfinder& g = this->graph;
+	int goal_col = goal % width, goal_row = goal / width;
+	g.NextGeneration();
+	g.Visit(start).g = 0;
+	g.Push(g.Heuristic(start % width, start / width, goal_col, goal_row), 0, start);
+	while(!g.open.empty()){
+		PathOpen top = g.Pop();
+		PathNode& node = g.nodes[top.cell];
+		if(node.closed) continue;
+		node.closed = true;
+		this->expanded++;
+		if(top.cell == goal) break;
+
+		auto relax = [&](int next, float cost){
+			if(cost == INFINITY or next == top.cell) return;
+			PathNode& child = g.Visit(next);
+			float cost_to = node.g + cost;
+			if(child.closed or cost_to >= child.g) return;
+			child.g = cost_to;
+			child.parent = top.cell;
+			g.Push(cost_to + g.Heuristic(next % width, next / width, goal_col, goal_row), cost_to, next);
+		};
+
+		int cluster = this->ClusterOf(top.cell);
+		PathCluster& cl = this->clusters[cluster];
+		int n = int(cl.nodes.size());
+		int index = int(std::find(cl.nodes.begin(), cl.nodes.end(), top.cell) - cl.nodes.begin());
+		if(top.cell == start){
+			for(int j=0; j!=n; ++j) relax(cl.nodes[j], start_costs[j]);
+		}
+		else if(index != n){
+			for(int j=0; j!=n; ++j) relax(cl.nodes[j], cl.costs[index*n + j]);
+		}
+		if(index != n){
+			for(auto& link : cl.links) if(link.first == index) relax(link.second, 1.0f);
+			if(cluster == gc) relax(goal, goal_costs[index]);
+		}
+	}
+	if(!g.Visit(goal).closed){
+		path.clear();
+		return false;
+	}
+
+	// Refine: entrances facing each other are neighbours, the rest are
+	// joined by a search inside their cluster
+	std::vector<int> route;
+	for(int cell = goal; cell != -1; cell = g.nodes[cell].parent) route.push_back(cell);
+	std::reverse(route.begin(), route.end());
+	for(size_t i=1; i!=route.size(); ++i){
+		int from = route[i - 1], to = route[i];
+		if(this->ClusterOf(from) != this->ClusterOf(to)) path.push_back(to);
+		else this->LocalPath(this->ClusterOf(from), from, to, path);
+	}
+	return true;
+}
+
+
+// ============== FLOW FIELD METHODS
+
+FlowField::FlowField(): dirs(), costs(), goals(), request_map(), request_goals(),
+	ready_dirs(), ready_costs(), ready_goals(), work_map(), search() {
+	width = 0; height = 0;
+	running = false; requested = false; ready = false;
+	ready_width = 0; ready_height = 0;
+}
+
+// 'search' must be set up on the map. Each cell points at its parent in
+// the search from the goals, which is its next step towards them.
+void FlowField::Build(Pathfinder& search, const std::vector<int>& goals, std::vector<int8_t>& dirs, std::vector<float>& costs){
+	int width = search.width, cells = search.width * search.height;
+	search.Flood(goals.data(), int(goals.size()));
+	dirs.assign(cells, -1);
+	costs.resize(cells);
+	for(int cell=0; cell!=cells; ++cell){
+		costs[cell] = search.Cost(cell);
+		int parent = search.nodes[cell].parent;
+		if(costs[cell] == INFINITY or parent == -1) continue;
+		int dx = parent % width - cell % width, dy = parent / width - cell / width;
+		for(int d=0; d!=8; ++d) if(DIR_X[d] == dx and DIR_Y[d] == dy) dirs[cell] = int8_t(d);
+	}
+}
+
+void FlowField::Compute(BlockBitmap& blocked, const std::vector<int>& goals){
+	this->work_map = blocked;
+	this->search.Init(this->work_map);
+	this->width = blocked.width;
+	this->height = blocked.height;
+	this->goals = goals;
+	Build(this->search, goals, this->dirs, this->costs);
+}
+
+void FlowField::Request(BlockBitmap& blocked, const std::vector<int>& goals){
+	std::unique_lock<std::mutex> lock(this->mtx);
+	if(!this->running){
+		this->running = true;
+		this->worker = std::thread(&FlowField::WorkerLoop, this);
+	}
+	this->request_map = blocked;
+	this->request_goals = goals;
+	this->requested = true;
+	this->cv.notify_all();
+}
+
+void FlowField::Request(BlockBitmap& blocked, int goal){
+	this->Request(blocked, std::vector<int>(1, goal));
+}
+
+void FlowField::WorkerLoop(){
+	std::vector<int8_t> dirs;
+	std::vector<float> costs;
+	std::vector<int> goals;
+	while(true){
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->cv.wait(lock, [this]{ return !this->running or this->requested; });
+			if(!this->running) return;
+			std::swap(this->work_map, this->request_map);
+			std::swap(goals, this->request_goals);
+			this->requested = false;
+		}
+		if(this->search.width != this->work_map.width or this->search.height != this->work_map.height){
+			this->search.Init(this->work_map);
+		}
+		Build(this->search, goals, dirs, costs);
+
+		std::unique_lock<std::mutex> lock(this->mtx);
+		std::swap(this->ready_dirs, dirs);
+		std::swap(this->ready_costs, costs);
+		std::swap(this->ready_goals, goals);
+		this->ready_width = this->work_map.width;
+		this->ready_height = this->work_map.height;
+		this->ready = true;
+	}
+}
+
+bool FlowField::Update(){
+	std::unique_lock<std::mutex> lock(this->mtx);
+	if(!this->ready) return false;
+	std::swap(this->dirs, this->ready_dirs);
+	std::swap(this->costs, this->ready_costs);
+	std::swap(this->goals, this->ready_goals);
+	this->width = this->ready_width;
+	this->height = this->ready_height;
+	this->ready = false;
+	return true;
+}
+
+bool FlowField::Direction(int cell, int& dx, int& dy){
+	if(cell < 0 or cell >= int(this->dirs.size()) or this->dirs[cell] < 0) return false;
+	dx = DIR_X[this->dirs[cell]];
+	dy = DIR_Y[this->dirs[cell]];
+	return true;
+}
+
+bool FlowField::Steer(Tilemap& tmap, float x, float y, float& dx, float& dy){
+	int cell = int(tmap.GetTile(x, y)), cx, cy;
+	if(!this->Direction(cell, cx, cy)) return false;
+	float tx, ty;
+	CellCenter(tmap, cell + cx + cy*width, tx, ty);
+	float len = std::sqrt((tx - x)*(tx - x) + (ty - y)*(ty - y));
+	if(len == 0) return false;
+	dx = (tx - x) / len;
+	dy = (ty - y) / len;
+	return true;
+}
+
+FlowField::~FlowField(){
+	{
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->running = false;
+	}
+	this->cv.notify_all();
+	if(this->worker.joinable()) this->worker.join();
+}
+
+
+// ============== PATH SERVICE METHODS
+
+PathService::PathService(): workers(), queue(), done(), snapshot(), local(), local_map() {
+	running = false;
+	pending = 0;
+	mode = PATH_JPS;
+}
+
+void PathService::Init(unsigned int worker_num, PathMode mode){
+	if(worker_num == 0){
+		worker_num = std::thread::hardware_concurrency();
+		worker_num = (worker_num > 1) ? worker_num - 1 : 1; // leave the render thread its core
+	}
+	this->mode = mode;
+	this->running = true;
+	for(unsigned int i=0; i!=worker_num; ++i){
+		this->workers.emplace_back(&PathService::WorkerLoop, this);
+	}
+}
+
+// Queries already made keep their snapshot alive until they finish
+void PathService::SetMap(const BlockBitmap& blocked){
+	this->snapshot = std::make_shared<const BlockBitmap>(blocked);
+}
+
+std::future<PathResult> PathService::Find(int start, int goal, std::function<void(PathResult&)> callback){
+	Request req;
+	req.start = start;
+	req.goal = goal;
+	req.map = this->snapshot;
+	req.callback = callback;
+	req.result.found = false;
+	req.result.expanded = 0;
+	std::future<PathResult> future = req.promise.get_future();
+	if(!req.map) std::cerr << "Error: path query before PathService::SetMap" << std::endl;
+
+	// No worker would ever pick the query up
+	if(this->workers.empty()){
+		if(req.map){
+			if(req.map != this->local_map){
+				this->local_map = req.map;
+				this->local.Init(*this->local_map, true, this->mode);
+			}
+			req.result.found = this->local.FindPath(req.start, req.goal, req.result.path);
+			req.result.expanded = this->local.expanded;
+		}
+		this->Deliver(req);
+		return future;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		// Without a map there is nothing to search, deliver on the next Update
+		if(req.map) this->queue.push_back(std::move(req));
+		else this->done.push_back(std::move(req));
+		this->pending++;
+	}
+	this->cv.notify_one();
+	return future;
+}
+
+void PathService::WorkerLoop(){
+	// Scratch memory of this thread, set up again when the snapshot changes
+	Pathfinder finder;
+	std::shared_ptr<const BlockBitmap> map;
+
+	while(true){
+		Request req;
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->cv.wait(lock, [this]{ return !this->running or !this->queue.empty(); });
+			if(!this->running) return;
+			req = std::move(this->queue.front());
+			this->queue.pop_front();
+		}
+
+		if(req.map != map){
+			map = req.map;
+			finder.Init(*map, true, this->mode);
+		}
+		req.result.found = finder.FindPath(req.start, req.goal, req.result.path);
+		req.result.expanded = finder.expanded;
+
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			this->done.push_back(std::move(req));
+		}
+		this->done_cv.notify_all();
+	}
+}
+
+// Delivers finished queries until the time budget runs out.
+// At least one query is delivered per call so queries always progress.
+int PathService::Update(double budget_ms){
+	auto start = std::chrono::steady_clock::now();
+	int delivered = 0;
+
+	while(true){
+		Request req;
+		{
+			std::lock_guard<std::mutex> lock(this->mtx);
+			if(this->done.empty()) break;
+			req = std::move(this->done.front());
+			this->done.pop_front();
+			this->pending--;
+		}
+
+		this->Deliver(req);
+		delivered++;
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if(elapsed.count() >= budget_ms) break;
+	}
+	return delivered;
+}
+
+void PathService::Deliver(Request& req){
+	if(req.callback) req.callback(req.result);
+	req.promise.set_value(std::move(req.result));
+}
+
+void PathService::Finish(){
+	while(this->Busy()){
+		{
+			std::unique_lock<std::mutex> lock(this->mtx);
+			this->done_cv.wait(lock, [this]{ return !this->done.empty(); });
+		}
+		this->Update(1e9);
+	}
+}
+
+bool PathService::Busy(){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->pending > 0;
+}
+
+PathService::~PathService(){
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->running = false;
+	}
+	this->cv.notify_all();
+	for(auto& w : this->workers) w.join();
+	// Queries never delivered are dropped, their futures report broken promises
+}
+
+
+// ============== OTHER FUNCTIONS
+
+void CellCenter(Tilemap& tmap, int cell, float& x, float& y){
+	x = tmap.origin_x + (float(cell % tmap.width) + 0.5f) * tmap.tile_w;
+	y = tmap.origin_y + (float(cell / tmap.width) + 0.5f) * tmap.tile_h;
+}
+
+} // namespace Engine
@@ -0,0 +1,271 @@
+/*
+
+	Grid pathfinding
+
+Paths are searched over a BlockBitmap of the tilemap, so they follow the
+same walls as collisions. Cells are indexed like tiles (col + row*width)
+and paths include both the start and the goal cell.
+
+	Engine::Pathfinder finder;
+	finder.Init(walls);
+	std::vector<int> path;
+	if(finder.FindPath(start_cell, goal_cell, path)) ...
+
+Search state lives in one node per cell, allocated once. Every query bumps
+a generation counter and nodes stamped with an older generation count as
+unvisited, so nothing is cleared between queries.
+
+Modes
+
+PATH_ASTAR expands every cell it reaches. PATH_JPS (Jump Point Search)
+scans straight and diagonal runs instead and only expands the cells where
+the way forward can change, which on open ground is a tiny fraction of
+them. The scans still sweep most of the free area around each expanded
+cell, so rows are read 64 cells per bitmap word and columns one word per
+cell. Where single wall cells are strewn everywhere nearly every cell is
+a jump point and JPS is no faster than A*. PATH_JPS_PLUS reads the straight runs from per-cell jump distances
+computed in advance. Nothing watches the map for them: whoever edits the
+BlockBitmap must call Update() on every PATH_JPS_PLUS Pathfinder using it,
+which rebuilds only the rows and columns around the cell. Both JPS modes
+need diagonal moves and return paths of the same length as A*, though
+ties between equally short routes may be broken differently.
+
+Hierarchy
+
+PathHierarchy splits the map into square clusters. Each border between two
+clusters gets a few entrance cells, and the path costs between the
+entrances of a cluster are cached. A query searches this small graph and
+then only refines the clusters the route passes through. Update() after an
+edit re-caches only the edited cluster, plus the neighbour sharing the
+border when the edit lies on it. Paths are near-optimal: on average a few
+percent longer than A*'s.
+
+Path service
+
+PathService answers queries on a pool of worker threads, each with its own
+Pathfinder. Queries search an immutable snapshot of the map taken by
+SetMap(), so the game and editor can keep changing tiles meanwhile; call
+SetMap() again for later queries to see the changes. Results are handed
+back by Update() on the main thread, which fulfils the future and runs the
+callback of each finished query, within a time budget.
+
+	paths.Init();
+	paths.SetMap(walls);
+	paths.Find(npc_cell, player_cell, [&](Engine::PathResult& r){ ... });
+	paths.Update(1.0); // once per frame
+
+Flow fields
+
+When many agents head for the same goal, FlowField runs one Dijkstra from
+the goal cells over the whole map and keeps, for every cell, the move
+towards the nearest goal. Agents then steer with one lookup each.
+Request() hands the computation to a worker thread working on its own copy
+of the map, and Update() swaps the finished field in, so the game keeps
+steering with the previous field meanwhile.
+
+	field.Request(walls, player_cell); // when the player enters another cell
+	field.Update(); // once per frame
+	field.Steer(tmap, npc_x, npc_y, vx, vy);
+
+*/
+
+#ifndef PATHFINDING_H
+#define PATHFINDING_H
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <functional>
+#include <memory>
+
+#include "Engine.h"
+#include "Collision.h"
+
+namespace Engine {
+
+// Search state of one cell
+struct PathNode {
+	uint32_t generation; // Query that last reached the node
+	bool closed;
+	float g; // Cost from the start
+	int parent; // Previous cell on the best path, -1 at the start
+	int open; // Index in the open list, -1 if not in it
+};
+
+enum PathMode { PATH_ASTAR = 0, PATH_JPS, PATH_JPS_PLUS };
+
+// Entry of the open list (binary heap)
+struct PathOpen {
+	float f, g;
+	int cell;
+};
+
+struct Pathfinder {
+	const BlockBitmap* blocked;
+	int width, height;
+	bool diagonal; // 8-connected, never cutting wall corners
+	PathMode mode;
+	int min_col, min_row, max_col, max_row; // Search area, the whole map by default
+	std::vector<int16_t> jumps; // JPS+: 4 per cell (+x, -x, +y, -y). >0 jump point that far, else -(free steps)
+	std::vector<PathNode> nodes;
+	std::vector<PathOpen> open; // Binary heap, each cell at most once
+	uint32_t generation;
+	int expanded; // Nodes expanded by the last query
+
+	Pathfinder(); //Constructor
+	void Init(const BlockBitmap& blocked, bool diagonal = true, PathMode mode = PATH_ASTAR); // Again if the map is resized
+	void Update(int cell); // The bitmap changed at 'cell'. Required in PATH_JPS_PLUS, no-op otherwise
+	bool FindPath(int start, int goal, std::vector<int>& path); // False if unreachable
+	void SetBounds(int col0, int row0, int col1, int row1); // Inclusive. JPS+ distances ignore it.
+	void ClearBounds();
+	void Flood(int start); // Costs from 'start' to every reachable cell (Dijkstra)
+	void Flood(const int* starts, int num); // From the nearest of several cells
+	float Cost(int cell); // After Flood(), INFINITY if not reached
+
+	bool Free(int col, int row);
+	float Heuristic(int col, int row, int goal_col, int goal_row);
+	PathNode& Visit(int cell); // Resets the node if it belongs to an older query
+	void NextGeneration();
+	unsigned Moves(int col, int row); // Bit d set if the step (DIR_X[d], DIR_Y[d]) is allowed
+	void Push(float f, float g, int cell); // Lowers the entry if the cell is already open
+	PathOpen Pop();
+	void SiftUp(int i);
+	void SiftDown(int i);
+	void Trace(int goal, std::vector<int>& path);
+
+	void SearchAStar(int goal);
+	void SearchJPS(int goal);
+	bool Forced(int col, int row, int dx, int dy);
+	int JumpStraight(int col, int row, int dx, int dy, int goal);
+	uint64_t BlockedWord(int row, int word); // Cells outside the search area count as blocked
+	int ScanRow(int col, int row, int dx, int goal); // JumpStraight along a row, 64 cells at a time
+	int ScanColumn(int col, int row, int dy, int goal); // JumpStraight along a column, one word read per cell
+	int Jump(int col, int row, int dx, int dy, int goal);
+	void BuildJumpRow(int row);
+	void BuildJumpColumn(int col);
+};
+
+// Entrance cells of one cluster and the cached costs between them
+struct PathCluster {
+	std::vector<int> nodes; // Entrance cells inside the cluster
+	std::vector<std::pair<int,int>> links; // (index in 'nodes', cell across the border)
+	std::vector<float> costs; // nodes x nodes, INFINITY if not connected inside the cluster
+	bool dirty; // Costs must be recomputed
+
+	PathCluster(); //Constructor
+};
+
+struct PathHierarchy {
+	BlockBitmap* blocked;
+	int width, height;
+	int cluster_size, clusters_x, clusters_y;
+	std::vector<PathCluster> clusters; // Row by row, like cells
+	std::vector<std::vector<std::pair<int,int>>> borders_x; // Entrances (left cell, right cell) between cluster k and k+1
+	std::vector<std::vector<std::pair<int,int>>> borders_y; // Entrances (lower cell, upper cell) between cluster k and the one above
+	Pathfinder local; // Searches confined to one cluster
+	Pathfinder graph; // Node storage for the search between entrances
+	int expanded; // Entrances plus refining cells expanded by the last query
+
+	PathHierarchy(); //Constructor
+	void Init(BlockBitmap& blocked, int cluster_size = 16); // Again if the map is resized
+	void Update(int cell); // The bitmap changed at 'cell'
+	bool FindPath(int start, int goal, std::vector<int>& path); // False if unreachable
+
+	int ClusterOf(int cell);
+	void Confine(int cluster); // Bounds 'local' to the cluster
+	void BuildBorder(int cluster, bool along_x);
+	void BuildCluster(int cluster);
+	bool LocalPath(int cluster, int from, int to, std::vector<int>& path); // Appends, without 'from'
+};
+
+struct FlowField {
+	int width, height;
+	std::vector<int8_t> dirs; // Move towards the nearest goal, -1 at goals and unreachable cells
+	std::vector<float> costs; // Cost to the nearest goal, INFINITY if unreachable
+	std::vector<int> goals; // Goals of 'dirs'
+
+	std::thread worker; // Started by the first Request()
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool running;
+	bool requested; // Guarded by mtx, as are the request_ and ready_ members
+	BlockBitmap request_map;
+	std::vector<int> request_goals;
+	bool ready; // A field waits for Update()
+	int ready_width, ready_height;
+	std::vector<int8_t> ready_dirs;
+	std::vector<float> ready_costs;
+	std::vector<int> ready_goals;
+	BlockBitmap work_map; // Worker's copy of the map
+	Pathfinder search; // Worker's search storage
+
+	FlowField(); //Constructor
+	void Compute(BlockBitmap& blocked, const std::vector<int>& goals); // On this thread, don't mix with Request()
+	void Request(BlockBitmap& blocked, const std::vector<int>& goals); // On the worker, replacing any pending request
+	void Request(BlockBitmap& blocked, int goal);
+	bool Update(); // Swaps in a finished field, true if there was one
+	bool Direction(int cell, int& dx, int& dy); // False at goals and unreachable cells
+	// Unit vector (screen coordinates) towards the centre of the next cell
+	bool Steer(Tilemap& tmap, float x, float y, float& dx, float& dy);
+	~FlowField(); //Destructor
+
+	void WorkerLoop();
+	static void Build(Pathfinder& search, const std::vector<int>& goals, std::vector<int8_t>& dirs, std::vector<float>& costs);
+};
+
+struct PathResult {
+	bool found;
+	std::vector<int> path;
+	int expanded;
+};
+
+struct PathService {
+
+	struct Request {
+		int start, goal;
+		std::shared_ptr<const BlockBitmap> map; // Snapshot current when requested
+		std::promise<PathResult> promise;
+		std::function<void(PathResult&)> callback; // May be empty
+		PathResult result;
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<Request> queue; // Guarded by mtx
+	std::deque<Request> done; // Guarded by mtx
+	std::mutex mtx;
+	std::condition_variable cv; // Wakes workers
+	std::condition_variable done_cv; // Signals a finished query
+	bool running;
+	int pending; // Queries not yet delivered
+	PathMode mode;
+	std::shared_ptr<const BlockBitmap> snapshot;
+	Pathfinder local; // Answers on the calling thread before Init()
+	std::shared_ptr<const BlockBitmap> local_map;
+
+	PathService(); //Constructor
+	// 0 workers picks one per spare core
+	void Init(unsigned int worker_num = 0, PathMode mode = PATH_JPS);
+	void SetMap(const BlockBitmap& blocked); // Copies the map for the following queries
+	// Before Init() the query is answered at once on the calling thread:
+	// the callback runs and the future is ready before Find returns
+	std::future<PathResult> Find(int start, int goal, std::function<void(PathResult&)> callback = nullptr);
+	int Update(double budget_ms = 1.0); // Delivers finished queries, returns count
+	void Finish(); // Blocks until every query is delivered
+	bool Busy();
+	~PathService(); //Destructor
+
+	void WorkerLoop();
+	void Deliver(Request& req);
+};
+
+// Screen position of the centre of a cell
+void CellCenter(Tilemap& tmap, int cell, float& x, float& y);
+
+} // namespace Engine
+
+#endif // PATHFINDING_H
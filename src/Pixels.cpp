@@ -0,0 +1,181 @@
+
+#include <iostream>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXELS_X86
+#endif
+
+#include "Engine.h"
+
+
+namespace Engine {
+
+// ============== Scalar kernels
+
+static void RGBAScalar(unsigned char* dest, const unsigned char* data, int pixels, unsigned char alpha){
+	for(int p=0; p!=pixels; ++p){
+		dest[0] = data[0]; dest[1] = data[1]; dest[2] = data[2];
+		dest[3] = alpha;
+		data += 3;
+		dest += 4;
+	}
+}
+
+static void RGBScalar(unsigned char* dest, const unsigned char* data, int pixels){
+	for(int p=0; p!=pixels; ++p){
+		dest[0] = data[0]; dest[1] = data[1]; dest[2] = data[2];
+		data += 4;
+		dest += 3;
+	}
+}
+
+
+#ifdef PIXELS_X86
+
+// ============== SSSE3 kernels, 16 pixels per iteration
+
+__attribute__((target("ssse3")))
+static void RGBASSSE3(unsigned char* dest, const unsigned char* data, int pixels, unsigned char alpha){
+	const __m128i mask = _mm_setr_epi8(0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+	const __m128i alpha_v = _mm_set1_epi32(int(uint32_t(alpha) << 24));
+	int p = 0;
+	for(; p + 16 <= pixels; p += 16){
+		__m128i in0 = _mm_loadu_si128((const __m128i*)(data));
+		__m128i in1 = _mm_loadu_si128((const __m128i*)(data + 16));
+		__m128i in2 = _mm_loadu_si128((const __m128i*)(data + 32));
+		// Line up 4 whole RGB pixels at the start of each register
+		__m128i px0 = in0;
+		__m128i px1 = _mm_alignr_epi8(in1, in0, 12);
+		__m128i px2 = _mm_alignr_epi8(in2, in1, 8);
+		__m128i px3 = _mm_srli_si128(in2, 4);
+		_mm_storeu_si128((__m128i*)(dest),      _mm_or_si128(_mm_shuffle_epi8(px0, mask), alpha_v));
+		_mm_storeu_si128((__m128i*)(dest + 16), _mm_or_si128(_mm_shuffle_epi8(px1, mask), alpha_v));
+		_mm_storeu_si128((__m128i*)(dest + 32), _mm_or_si128(_mm_shuffle_epi8(px2, mask), alpha_v));
+		_mm_storeu_si128((__m128i*)(dest + 48), _mm_or_si128(_mm_shuffle_epi8(px3, mask), alpha_v));
+		data += 48;
+		dest += 64;
+	}
+	RGBAScalar(dest, data, pixels - p, alpha);
+}
+
+__attribute__((target("ssse3")))
+static void RGBSSSE3(unsigned char* dest, const unsigned char* data, int pixels){
+	const __m128i mask = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+	int p = 0;
+	for(; p + 16 <= pixels; p += 16){
+		// 12 packed bytes at the start of each register
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data)), mask);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+		__m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+		__m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+		_mm_storeu_si128((__m128i*)(dest),      _mm_or_si128(a, _mm_slli_si128(b, 12)));
+		_mm_storeu_si128((__m128i*)(dest + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+		_mm_storeu_si128((__m128i*)(dest + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+		data += 64;
+		dest += 48;
+	}
+	RGBScalar(dest, data, pixels - p);
+}
+
+
+// ============== AVX2 kernels, 8 pixels per step
+
+__attribute__((target("avx2")))
+static void RGBAAVX2(unsigned char* dest, const unsigned char* data, int pixels, unsigned char alpha){
+	const __m256i mask = _mm256_setr_epi8(
+		0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1,
+		0,1,2,-1, 3,4,5,-1, 6,7,8,-1, 9,10,11,-1);
+	const __m256i alpha_v = _mm256_set1_epi32(int(uint32_t(alpha) << 24));
+	int p = 0;
+	// Each step reads 28 bytes for 8 pixels (24), so stop 2 pixels early
+	for(; p + 10 <= pixels; p += 8){
+		__m128i lo = _mm_loadu_si128((const __m128i*)(data));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(data + 12));
+		__m256i px = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		_mm256_storeu_si256((__m256i*)dest, _mm256_or_si256(_mm256_shuffle_epi8(px, mask), alpha_v));
+		data += 24;
+		dest += 32;
+	}
+	RGBAScalar(dest, data, pixels - p, alpha);
+}
+
+__attribute__((target("avx2")))
+static void RGBAVX2(unsigned char* dest, const unsigned char* data, int pixels){
+	const __m256i mask = _mm256_setr_epi8(
+		0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1,
+		0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+	// Gather the two 12-byte lane halves into 24 contiguous bytes
+	const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	const __m256i store_mask = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+	int p = 0;
+	for(; p + 8 <= pixels; p += 8){
+		__m256i px = _mm256_loadu_si256((const __m256i*)data);
+		px = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(px, mask), pack);
+		_mm256_maskstore_epi32((int*)dest, store_mask, px);
+		data += 32;
+		dest += 24;
+	}
+	RGBScalar(dest, data, pixels - p);
+}
+
+#endif // PIXELS_X86
+
+
+// ============== Dispatch
+
+static bool KernelSupported(PixelKernel kernel){
+#ifdef PIXELS_X86
+	if(kernel == KERNEL_AVX2) return __builtin_cpu_supports("avx2");
+	if(kernel == KERNEL_SSSE3) return __builtin_cpu_supports("ssse3");
+#endif
+	return kernel == KERNEL_SCALAR;
+}
+
+static PixelKernel BestPixelKernel(){
+	if(KernelSupported(KERNEL_AVX2)) return KERNEL_AVX2;
+	if(KernelSupported(KERNEL_SSSE3)) return KERNEL_SSSE3;
+	return KERNEL_SCALAR;
+}
+
+PixelKernel PIXEL_KERNEL = BestPixelKernel();
+
+bool SetPixelKernel(PixelKernel kernel){
+	if(!KernelSupported(kernel)) return false;
+	PIXEL_KERNEL = kernel;
+	return true;
+}
+
+/*
+Converts pixel data from RGB to RGBA.
+Return data must have at least (total bytes + pixels) memory spaces.
+Fills new alpha channels with given value (default = 255
+*/
+unsigned char* rgba(unsigned char *dest, unsigned char* data, int pixels, unsigned char alpha){
+	switch(PIXEL_KERNEL){
+#ifdef PIXELS_X86
+		case KERNEL_AVX2: RGBAAVX2(dest, data, pixels, alpha); break;
+		case KERNEL_SSSE3: RGBASSSE3(dest, data, pixels, alpha); break;
+#endif
+		default: RGBAScalar(dest, data, pixels, alpha);
+	}
+	return dest;
+}
+
+/*
+Converts pixel data from RGBA to RGB.
+Return data must have at least (total bytes - pixels) memory spaces.
+*/
+unsigned char* rgb(unsigned char* dest, unsigned char* data, int pixels){
+	switch(PIXEL_KERNEL){
+#ifdef PIXELS_X86
+		case KERNEL_AVX2: RGBAVX2(dest, data, pixels); break;
+		case KERNEL_SSSE3: RGBSSSE3(dest, data, pixels); break;
+#endif
+		default: RGBScalar(dest, data, pixels);
+	}
+	return dest;
+}
+
+} // namespace Engine
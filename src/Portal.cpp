@@ -0,0 +1,192 @@
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <cstdlib>
+#include <chrono>
+
+#include "Engine.h"
+#include "Pack.h"
+#include "Portal.h"
+
+
+namespace Engine {
+
+
+// ============== PORTAL SET METHODS
+
+PortalSet::PortalSet(): portals(), preloads(), dropped(), tileset() {
+	tilesize = 0; width = 0;
+	preload_radius = 4;
+	last_cell = -1;
+	loader = nullptr;
+}
+
+void PortalSet::Init(Tilemap& tmap, int preload_radius, TextureLoader* loader){
+	this->tileset = tmap.tileset;
+	this->tilesize = tmap.tilesize;
+	this->width = tmap.width;
+	this->preload_radius = preload_radius;
+	this->loader = loader;
+	this->last_cell = -1;
+	this->portals.clear();
+	std::string path = tmap.ftmap + ".portals";
+	this->Read(tmap, path);
+	// Preloads the new map does not lead to are dropped by the next Update()
+}
+
+void PortalSet::Read(Tilemap& tmap, std::string& path){
+	const unsigned char* data;
+	size_t size;
+	std::string text;
+	if(ASSET_PACK.Find(path, data, size)) text.assign((const char*)data, size);
+	else {
+		std::ifstream file(path.c_str());
+		if(!file.is_open()) return; // No portals
+		text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	}
+
+	std::istringstream lines(text);
+	std::string line;
+	for(int number=1; std::getline(lines, line); ++number){
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		Portal portal;
+		int col, row;
+		if(!(fields >> col >> row)) continue; // Blank or comment
+		if(!(fields >> portal.destination)){
+			std::cerr << path << ":" << number << ": missing destination map" << std::endl;
+			continue;
+		}
+		if(!(fields >> portal.spawn_col >> portal.spawn_row)){
+			portal.spawn_col = -1;
+			portal.spawn_row = -1;
+		}
+		fields >> portal.tileset;
+		if(col < 0 or row < 0 or col >= tmap.width or row >= tmap.height or tmap.logic_grid[col + row*tmap.width] != L_PORTAL){
+			std::cerr << path << ":" << number << ": cell " << col << "," << row << " is not a portal tile" << std::endl;
+			continue;
+		}
+		portal.cell = col + row*tmap.width;
+		this->portals.push_back(portal);
+	}
+
+	#ifdef DEBUG
+	std::cout << "[DEBUG] " << this->portals.size() << " portals in " << path << std::endl;
+	#endif //DEBUG
+}
+
+bool PortalSet::Near(int portal, int cell, int radius){
+	int pcell = this->portals[portal].cell;
+	return std::abs(pcell % width - cell % width) <= radius and std::abs(pcell / width - cell / width) <= radius;
+}
+
+int PortalSet::Find(int portal){
+	Portal& p = this->portals[portal];
+	for(size_t i=0; i!=this->preloads.size(); ++i){
+		Preload& pre = this->preloads[i];
+		if(pre.destination == p.destination and pre.spawn_col == p.spawn_col and pre.spawn_row == p.spawn_row and pre.tileset == p.tileset) return int(i);
+	}
+	return -1;
+}
+
+bool PortalSet::Ready(int portal){
+	int i = this->Find(portal);
+	return i != -1 and this->preloads[i].map;
+}
+
+void PortalSet::Start(int portal){
+	Portal& p = this->portals[portal];
+	Preload pre;
+	pre.destination = p.destination;
+	pre.spawn_col = p.spawn_col;
+	pre.tileset = p.tileset;
+	pre.spawn_row = p.spawn_row;
+
+	#ifdef DEBUG
+	std::cout << "[DEBUG] Preloading " << p.destination << std::endl;
+	#endif //DEBUG
+
+	// Copied here so the worker shares nothing with the main thread
+	Tileset tset = this->tileset;
+	if(!p.tileset.empty()){
+		// The cache and loader are main thread only: the decode starts now
+		// and the destination builds its tiles once it is done
+		TextureDesc desc;
+		desc.indexed = true; // As in Tilemap::Init
+		tset.Init(TEXTURE_CACHE.Get(p.tileset, this->loader, &desc));
+	}
+	std::string path = p.destination;
+	int size = this->tilesize, col = p.spawn_col, row = p.spawn_row;
+	pre.loading = std::async(std::launch::async, [tset, path, size, col, row]() mutable {
+		std::unique_ptr<Tilemap> map(new Tilemap());
+		map->Load(path, tset, size);
+		if(col >= 0 and row >= 0 and col < map->width and row < map->height) map->CenterOn(col + row*map->width);
+		return map;
+	});
+	this->preloads.push_back(std::move(pre));
+}
+
+void PortalSet::Drop(int preload){
+	// Destroying an unfinished std::async future would block until it ends.
+	// A destination tileset still decoding is held by its loader request.
+	if(this->preloads[preload].loading.valid()) this->dropped.push_back(std::move(this->preloads[preload].loading));
+	this->preloads.erase(this->preloads.begin() + preload);
+}
+
+std::unique_ptr<Tilemap> PortalSet::Update(Tilemap& tmap, int cell){
+	std::unique_ptr<Tilemap> next;
+	if(cell < 0 or cell >= tmap.width*tmap.height) return next;
+
+	// Forget destinations left well behind, so walking along the edge of
+	// the preload radius does not keep reloading them
+	for(int i=int(this->preloads.size()) - 1; i >= 0; --i){
+		bool wanted = false;
+		for(int p=0; p!=int(this->portals.size()) and !wanted; ++p){
+			wanted = this->Find(p) == i and this->Near(p, cell, 2*this->preload_radius);
+		}
+		if(!wanted) this->Drop(i);
+	}
+	for(int p=0; p!=int(this->portals.size()); ++p){
+		if(this->Near(p, cell, this->preload_radius) and this->Find(p) == -1) this->Start(p);
+	}
+
+	// GL side of finished loads
+	for(Preload& pre : this->preloads){
+		if(!pre.loading.valid() or pre.loading.wait_for(std::chrono::seconds(0)) != std::future_status::ready) continue;
+		pre.map = pre.loading.get();
+		pre.map->Upload();
+	}
+	for(int i=int(this->dropped.size()) - 1; i >= 0; --i){
+		if(this->dropped[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready) this->dropped.erase(this->dropped.begin() + i);
+	}
+
+	// Stepping onto a portal
+	bool stepped = this->last_cell != -1 and cell != this->last_cell;
+	this->last_cell = cell;
+	if(!stepped or tmap.logic_grid[cell] != L_PORTAL) return next;
+	for(int p=0; p!=int(this->portals.size()); ++p){
+		if(this->portals[p].cell != cell) continue;
+		int i = this->Find(p);
+		if(i == -1){
+			this->Start(p);
+			i = int(this->preloads.size()) - 1;
+		}
+		Preload& pre = this->preloads[i];
+		if(!pre.map){
+			// Arrived faster than the loader: this frame waits
+			#ifdef DEBUG
+			std::cout << "[DEBUG] Waiting for " << pre.destination << std::endl;
+			#endif //DEBUG
+			pre.map = pre.loading.get();
+			pre.map->Upload();
+		}
+		next = std::move(pre.map);
+		this->preloads.erase(this->preloads.begin() + i);
+		break;
+	}
+	return next;
+}
+
+} // namespace Engine
@@ -0,0 +1,91 @@
+/*
+
+	Portals between tilemaps
+
+Cells marked L_PORTAL in the logic grid lead to another map. Where they
+lead is listed in a text file next to the map, 'res/test3.tm.portals',
+one portal per line:
+
+	# col row destination [spawn_col spawn_row [tileset]]
+	2 35 res/test2.tm 13 2
+
+Without a spawn cell the player arrives on the destination's L_SPAWN tile.
+Without a tileset the destination is drawn with the current map's one.
+L_PORTAL cells with no line are left alone.
+
+	Engine::PortalSet portals;
+	portals.Init(*tilemap, 4, &loader); // Optional TextureLoader for destination tilesets
+	while(...){
+		std::unique_ptr<Engine::Tilemap> next = portals.Update(*tilemap, player_cell);
+		if(next){
+			tilemap.swap(next); // Already centred on the spawn cell
+			portals.Init(*tilemap, 4, &loader);
+		}
+	}
+
+Once the player comes within 'preload_radius' tiles of a portal, its
+destination is read and its vertices built on a background thread. The GL
+buffers are created on the main thread as soon as it is ready, so stepping
+through is only a pointer swap. A destination tileset is decoded by the
+loader meanwhile; if it is still loading when the player steps through, the
+map shows up as soon as it is (see Tileset::Refresh) instead of stalling
+the frame. Destinations the player walks away from are dropped again.
+
+*/
+
+#ifndef PORTAL_H
+#define PORTAL_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <future>
+
+#include "Engine.h"
+
+namespace Engine {
+
+struct Portal {
+	int cell; // In the map holding the portal
+	std::string destination; // Tilemap file
+	int spawn_col, spawn_row; // Arrival cell in the destination, -1 for its L_SPAWN tile
+	std::string tileset; // Image of the destination's tiles, empty to keep the current one
+};
+
+struct PortalSet {
+	// Destination loading in the background, or ready to enter
+	struct Preload {
+		std::string destination;
+		int spawn_col, spawn_row;
+		std::string tileset;
+		std::future<std::unique_ptr<Tilemap>> loading;
+		std::unique_ptr<Tilemap> map; // Set once loaded and uploaded
+	};
+
+	std::vector<Portal> portals;
+	std::vector<Preload> preloads;
+	std::vector<std::future<std::unique_ptr<Tilemap>>> dropped; // Loads no longer wanted, kept until they end
+	Tileset tileset; // Shared by the destinations
+	int tilesize;
+	int width; // Of the current map
+	int preload_radius; // In tiles
+	int last_cell; // Portals trigger when stepped onto, not while standing on them
+	TextureLoader* loader; // Decodes destination tilesets, synchronous if null
+
+	PortalSet(); //Constructor
+	void Init(Tilemap& tmap, int preload_radius = 4, TextureLoader* loader = nullptr); // Reads the map's portal file, if any
+	// Call every frame with the player's cell. Returns the destination map
+	// when the player steps onto a portal, null otherwise.
+	std::unique_ptr<Tilemap> Update(Tilemap& tmap, int cell);
+	bool Ready(int portal); // Destination preloaded
+
+	void Read(Tilemap& tmap, std::string& path);
+	int Find(int portal); // Preload of a portal's destination, -1 if none
+	void Start(int portal); // Begins loading the destination
+	bool Near(int portal, int cell, int radius);
+	void Drop(int preload);
+};
+
+} // namespace Engine
+
+#endif // PORTAL_H
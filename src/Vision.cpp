@@ -0,0 +1,170 @@
+
+#include <algorithm>
+#include <vector>
+
+#include "Engine.h"
+#include "Collision.h"
+#include "Vision.h"
+
+
+namespace Engine {
+
+// Quadrants as (depth, column) to map offsets: north, east, south, west
+static const int QUAD_DEPTH_X[4] = {0, 1, 0, -1};
+static const int QUAD_DEPTH_Y[4] = {1, 0, -1, 0};
+static const int QUAD_COL_X[4] = {1, 0, 1, 0};
+static const int QUAD_COL_Y[4] = {0, 1, 0, 1};
+
+static int FloorDiv(int a, int b){
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+
+// ============== FIELD OF VIEW METHODS
+
+FieldOfView::FieldOfView(): bits(), prev_bits(), entered(), left() {
+	radius = 0; side = 0; words = 0;
+	col = -1; row = -1; prev_col = -1; prev_row = -1;
+	map_width = 0; map_height = 0;
+	walls_version = 0; walls = nullptr;
+}
+
+void FieldOfView::Init(int radius){
+	this->radius = radius;
+	this->side = 2*radius + 1;
+	this->words = (side + 63) / 64;
+	this->bits.assign(size_t(side) * words, 0);
+	this->prev_bits.assign(size_t(side) * words, 0);
+	this->col = -1; this->row = -1;
+}
+
+bool FieldOfView::Visible(int col, int row) const {
+	if(col < 0 or row < 0 or col >= map_width or row >= map_height) return false;
+	int x = col - this->col + radius, y = row - this->row + radius;
+	if(x < 0 or x >= side or y < 0 or y >= side) return false;
+	return (this->bits[size_t(y) * words + (x >> 6)] >> (x & 63)) & 1;
+}
+
+// Off-map cells block sight but are never marked, so the window only
+// holds map cells and Count() needs no clipping
+void FieldOfView::Mark(int col, int row){
+	if(col < 0 or row < 0 or col >= this->walls->width or row >= this->walls->height) return;
+	int dx = col - this->col, dy = row - this->row;
+	if(dx*dx + dy*dy > radius*radius + radius) return; // Round edge
+	int x = dx + radius, y = dy + radius;
+	this->bits[size_t(y) * words + (x >> 6)] |= uint64_t(1) << (x & 63);
+}
+
+// Outside the map counts as wall
+bool FieldOfView::Opaque(int col, int row){
+	return col < 0 or row < 0 or col >= this->walls->width or row >= this->walls->height or this->walls->Get(col, row);
+}
+
+// Scans one row of a quadrant between two slopes (start_num/start_den to
+// end_num/end_den, columns over depth), then the rows behind the gaps.
+void FieldOfView::Scan(int quadrant, int depth, int start_num, int start_den, int end_num, int end_den){
+	if(depth > radius) return;
+	auto cell_x = [&](int c){ return this->col + depth*QUAD_DEPTH_X[quadrant] + c*QUAD_COL_X[quadrant]; };
+	auto cell_y = [&](int c){ return this->row + depth*QUAD_DEPTH_Y[quadrant] + c*QUAD_COL_Y[quadrant]; };
+
+	// Columns whose centre lies within the slopes, rounding ties outwards
+	int min_col = FloorDiv(2*depth*start_num + start_den, 2*start_den);
+	int max_col = -FloorDiv(-(2*depth*end_num - end_den), 2*end_den);
+	int prev = -1; // -1 none yet, 0 floor, 1 wall
+	for(int c=min_col; c<=max_col; ++c){
+		int x = cell_x(c), y = cell_y(c);
+		int wall = this->Opaque(x, y) ? 1 : 0;
+		// Floors only when their centre is in view, which keeps sight symmetric
+		bool symmetric = c*start_den >= depth*start_num and c*end_den <= depth*end_num;
+		if(wall or symmetric) this->Mark(x, y);
+		// Slope of the cell's left edge: (2c - 1) / (2 depth)
+		if(prev == 1 and !wall){
+			start_num = 2*c - 1; start_den = 2*depth;
+		}
+		if(prev == 0 and wall) this->Scan(quadrant, depth + 1, start_num, start_den, 2*c - 1, 2*depth);
+		prev = wall;
+	}
+	if(prev == 0) this->Scan(quadrant, depth + 1, start_num, start_den, end_num, end_den);
+}
+
+void FieldOfView::Compute(const BlockBitmap& walls, int col, int row){
+	this->walls = &walls;
+	this->walls_version = walls.version;
+	this->map_width = walls.width;
+	this->map_height = walls.height;
+	this->col = col;
+	this->row = row;
+	std::fill(this->bits.begin(), this->bits.end(), 0);
+	this->entered.clear();
+	this->left.clear();
+	if(col < 0 or row < 0 or col >= walls.width or row >= walls.height) return;
+
+	this->Mark(col, row);
+	for(int q=0; q!=4; ++q) this->Scan(q, 1, -1, 1, 1, 1);
+	this->walls = nullptr;
+}
+
+bool FieldOfView::Update(const BlockBitmap& walls, int col, int row){
+	if(col == this->col and row == this->row and walls.version == this->walls_version){
+		this->entered.clear();
+		this->left.clear();
+		return false;
+	}
+
+	std::swap(this->bits, this->prev_bits);
+	this->prev_col = this->col;
+	this->prev_row = this->row;
+	this->Compute(walls, col, row);
+
+	// Each window against the other shifted onto it, a word at a time:
+	// cells only in the new one entered, cells only in the old one left
+	Diff(this->bits, col, row, this->prev_bits, prev_col, prev_row, this->entered);
+	Diff(this->prev_bits, prev_col, prev_row, this->bits, col, row, this->left);
+	return true;
+}
+
+// 64 cells of a window row from column x on, none outside the window
+static uint64_t WindowWord(const uint64_t* row, int words, int x){
+	int w = FloorDiv(x, 64), shift = x - 64*w;
+	uint64_t low = (w >= 0 and w < words) ? row[w] : 0;
+	uint64_t high = (w + 1 >= 0 and w + 1 < words) ? row[w + 1] : 0;
+	return shift ? (low >> shift) | (high << (64 - shift)) : low;
+}
+
+// Lists the map cells set in window 'a' but not in window 'b'
+void FieldOfView::Diff(const std::vector<uint64_t>& a, int a_col, int a_row, const std::vector<uint64_t>& b, int b_col, int b_row, std::vector<int>& cells){
+	if(a_col == -1 and a_row == -1) return;
+	bool b_empty = b_col == -1 and b_row == -1;
+	for(int y=0; y!=side; ++y){
+		int r = a_row - radius + y;
+		int by = r - b_row + radius;
+		bool b_has_row = !b_empty and by >= 0 and by < side;
+		for(int w=0; w!=words; ++w){
+			uint64_t only = a[size_t(y) * words + w];
+			if(b_has_row) only &= ~WindowWord(&b[size_t(by) * words], words, w*64 + a_col - b_col);
+			while(only){
+				int x = w*64 + __builtin_ctzll(only);
+				cells.push_back(r*map_width + a_col - radius + x);
+				only &= only - 1;
+			}
+		}
+	}
+}
+
+void FieldOfView::Reveal(BlockBitmap& seen) const {
+	for(int y=0; y!=side; ++y){
+		for(int x=0; x!=side; ++x){
+			int c = this->col - radius + x, r = this->row - radius + y;
+			if(c < 0 or r < 0 or c >= seen.width or r >= seen.height) continue;
+			if((this->bits[size_t(y) * words + (x >> 6)] >> (x & 63)) & 1) seen.Set(c, r, true);
+		}
+	}
+}
+
+int FieldOfView::Count() const {
+	int count = 0;
+	for(uint64_t word : this->bits) count += __builtin_popcountll(word);
+	return count;
+}
+
+} // namespace Engine
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#include "Pack.h"
+
+
+/*
+
+============== Asset Packer ==============
+
+Bundles resource files into a single pack read by Engine::ASSET_PACK.
+Files are stored under the path given on the command line:
+
+	asset-packer res.pack res/vertex.shader res/fragment.shader res/tileset.png ...
+
+*/
+
+
+int main(int argc, char** argv)
+{
+	if(argc < 3){
+		std::cout << "Usage: " << argv[0] << " <output> <files...>" << std::endl;
+		return -1;
+	}
+
+	std::vector<Engine::PackEntry> toc(argc - 2);
+	std::vector<std::vector<char>> blobs(argc - 2);
+	uint64_t offset = sizeof(Engine::PackHeader) + toc.size() * sizeof(Engine::PackEntry);
+
+	for(size_t i=0; i!=toc.size(); ++i){
+		std::string name = argv[i+2];
+		if(name.size() >= sizeof(toc[i].name)){
+			std::cout << "Error: name too long '" << name << "'" << std::endl;
+			return -1;
+		}
+		std::ifstream file(name.c_str(), std::ios::binary);
+		if(!file.is_open()){
+			std::cout << "Error opening file " << name << std::endl;
+			return -1;
+		}
+		blobs[i].assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+		offset = (offset + Engine::PACK_ALIGN - 1) / Engine::PACK_ALIGN * Engine::PACK_ALIGN;
+		std::memset(&toc[i], 0, sizeof(toc[i]));
+		std::strcpy(toc[i].name, name.c_str());
+		toc[i].offset = offset;
+		toc[i].size = blobs[i].size();
+		offset += blobs[i].size();
+	}
+
+	std::ofstream out(argv[1], std::ios::binary|std::ios::trunc);
+	if(!out.is_open()){
+		std::cout << "Error opening file " << argv[1] << std::endl;
+		return -1;
+	}
+	Engine::PackHeader hdr;
+	std::memcpy(hdr.magic, Engine::PACK_MAGIC, 4);
+	hdr.version = Engine::PACK_VERSION;
+	hdr.entry_num = toc.size();
+	hdr.reserved = 0;
+	out.write((const char*)&hdr, sizeof(hdr));
+	out.write((const char*)toc.data(), toc.size() * sizeof(Engine::PackEntry));
+
+	for(size_t i=0; i!=toc.size(); ++i){
+		std::string padding(toc[i].offset - uint64_t(out.tellp()), '\0');
+		out.write(padding.data(), padding.size());
+		out.write(blobs[i].data(), blobs[i].size());
+		std::cout << toc[i].name << " (" << toc[i].size << " bytes)" << std::endl;
+	}
+	out.close();
+	return 0;
+}
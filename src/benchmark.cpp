@@ -0,0 +1,357 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <cstdlib>
+#include <utility>
+
+#include "Engine.h"
+#include "Collision.h"
+#include "Pathfinding.h"
+#include "Vision.h"
+#include "Lighting.h"
+
+
+/*
+
+============== Engine micro-benchmarks ==============
+
+Runs CPU-side engine routines on synthetic data, no window needed.
+
+	./benchmark           run everything
+	./benchmark pixels    run one section (pixels, collision, broadphase, path, flow, fov, light)
+
+*/
+
+
+// Best of 'runs' timings of f(), in seconds
+double Time(std::function<void()> f, int runs = 5){
+	double best = 1e30;
+	for(int r=0; r!=runs; ++r){
+		auto start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if(elapsed.count() < best) best = elapsed.count();
+	}
+	return best;
+}
+
+
+void BenchPixels(){
+	const char* names[] = {"scalar", "ssse3", "avx2"};
+	std::cout << "== RGB <-> RGBA conversion (GB/s of input + output)" << std::endl;
+	std::cout << "MPixel\tkernel\trgb->rgba\trgba->rgb" << std::endl;
+
+	for(int mpix : {1, 4, 16, 64}){
+		int pixels = mpix * 1024 * 1024;
+		std::vector<unsigned char> rgb_data(size_t(pixels) * 3), rgba_data(size_t(pixels) * 4);
+		for(size_t i=0; i!=rgb_data.size(); ++i) rgb_data[i] = (unsigned char)(i * 31);
+		double bytes = 7.0 * pixels;
+
+		for(int k : {Engine::KERNEL_SCALAR, Engine::KERNEL_SSSE3, Engine::KERNEL_AVX2}){
+			if(!Engine::SetPixelKernel(Engine::PixelKernel(k))) continue;
+			double t_rgba = Time([&]{ Engine::rgba(&rgba_data[0], &rgb_data[0], pixels); });
+			double t_rgb = Time([&]{ Engine::rgb(&rgb_data[0], &rgba_data[0], pixels); });
+			std::cout << mpix << "\t" << names[k] << "\t" << bytes / t_rgba / 1e9
+			          << "\t\t" << bytes / t_rgb / 1e9 << std::endl;
+		}
+	}
+}
+
+
+void BenchCollision(){
+	const char* names[] = {"scalar", "sse", "avx"};
+	const int box_num = 10000, queries = 1000;
+	std::cout << "== One AABB against " << box_num << " boxes (SoA batch)" << std::endl;
+	std::cout << "kernel\tns/query\tMbox/s\thits" << std::endl;
+
+	Engine::AABBList list;
+	std::vector<Engine::AABB> probes;
+	std::srand(1);
+	auto rnd = []{ return float(std::rand()) / float(RAND_MAX) * 2.0f - 1.0f; };
+	for(int i=0; i!=box_num; ++i){
+		float x = rnd(), y = rnd();
+		list.Add(Engine::AABB(x, y, x + 0.02f, y + 0.02f));
+	}
+	for(int i=0; i!=queries; ++i){
+		float x = rnd(), y = rnd();
+		probes.push_back(Engine::AABB(x, y, x + 0.05f, y + 0.05f));
+	}
+	std::vector<unsigned char> hits(box_num);
+
+	for(int k : {Engine::OVERLAP_SCALAR, Engine::OVERLAP_SSE, Engine::OVERLAP_AVX}){
+		if(!Engine::SetOverlapKernel(Engine::OverlapKernel(k))) continue;
+		long total = 0;
+		double t = Time([&]{
+			total = 0;
+			for(auto& p : probes) total += Engine::OverlapBatch(p, list, &hits[0]);
+		});
+		std::cout << names[k] << "\t" << t / queries * 1e9 << "\t\t"
+		          << double(box_num) * queries / t / 1e6 << "\t" << total << std::endl;
+	}
+}
+
+
+void BenchBroadphase(){
+	std::cout << "== Entity vs entity collisions (spatial hash)" << std::endl;
+	std::cout << "entities\tbuild ms\tpairs ms\toverlaps\tbrute force" << std::endl;
+
+	std::srand(3);
+	auto rnd = []{ return float(std::rand()) / float(RAND_MAX); };
+	for(int n : {500, 2000, 5000, 20000}){
+		// Player-sized boxes spread over a map-sized area
+		std::vector<Engine::AABB> boxes;
+		for(int i=0; i!=n; ++i){
+			float x = rnd()*8 - 4, y = rnd()*8 - 4, side = 0.02f + rnd()*0.06f;
+			boxes.push_back(Engine::AABB(x, y, x + side, y + side));
+		}
+
+		Engine::SpatialHash hash;
+		hash.Init(0.08f);
+		for(auto& b : boxes) hash.Insert(b);
+		std::vector<std::pair<int,int>> pairs;
+		double t_build = Time([&]{ hash.Build(); });
+		double t_pairs = Time([&]{ hash.Collisions(pairs); });
+
+		long brute = 0;
+		for(int i=0; i!=n; ++i)
+			for(int j=i+1; j!=n; ++j) brute += boxes[i].Overlaps(boxes[j]);
+		std::cout << n << "\t\t" << t_build * 1e3 << "\t\t" << t_pairs * 1e3 << "\t\t"
+		          << pairs.size() << "\t\t" << brute << std::endl;
+	}
+}
+
+
+// Synthetic 256x256 maps: scattered walls, or open ground crossed by long walls
+static void PathMap(Engine::BlockBitmap& map, bool scattered){
+	const int side = 256;
+	map.Init(side, side);
+	std::srand(4);
+	if(scattered){
+		for(int r=0; r!=side; ++r)
+			for(int c=0; c!=side; ++c) map.Set(c, r, std::rand() % 100 < 20);
+		return;
+	}
+	for(int w=0; w!=60; ++w){
+		int c = std::rand() % side, r = std::rand() % side, len = 10 + std::rand() % 60;
+		bool vertical = std::rand() % 2;
+		for(int i=0; i!=len; ++i){
+			if(vertical and r + i < side) map.Set(c, r + i, true);
+			if(!vertical and c + i < side) map.Set(c + i, r, true);
+		}
+	}
+}
+
+// Shipped .tm maps, read directly: a Tilemap needs a GL context.
+// Layout: 1 byte width, 1 byte height, tile grid, logic grid.
+static bool ShippedMap(Engine::BlockBitmap& map, const char* path){
+	std::ifstream file(path, std::ios::binary);
+	std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if(data.size() < 2) return false;
+	int width = data[0], height = data[1];
+	if(width == 0 or height == 0 or data.size() < size_t(2 + 2*width*height)) return false;
+	map.Init(width, height);
+	for(int i=0; i!=width*height; ++i) map.Set(i % width, i / width, data[2 + width*height + i] == Engine::TILE_WALL);
+	return true;
+}
+
+void BenchPath(){
+	const int queries = 500;
+	const char* modes[] = {"A*", "JPS", "JPS+"};
+	std::cout << "== Grid paths, " << queries << " random queries per map" << std::endl;
+	std::cout << "map\t\tmode\tfound\texpanded/query\tus/query\tqueries/s" << std::endl;
+
+	// Goals anywhere on the map, then within 'range' tiles of the start, as
+	// for NPCs chasing something on screen
+	std::vector<std::pair<std::string, Engine::BlockBitmap>> maps(7);
+	std::vector<int> ranges(7, 0);
+	maps[0].first = "scattered"; PathMap(maps[0].second, true);
+	maps[1].first = "open"; PathMap(maps[1].second, false);
+	maps[2].first = "scattered/32"; PathMap(maps[2].second, true); ranges[2] = 32;
+	maps[3].first = "open/32"; PathMap(maps[3].second, false); ranges[3] = 32;
+	const char* shipped[] = {"res/test.tm", "res/test2.tm", "res/test3.tm"};
+	for(int i=0; i!=3; ++i){
+		maps[4 + i].first = shipped[i] + 4;
+		if(!ShippedMap(maps[4 + i].second, shipped[i])) maps[4 + i].first.clear();
+	}
+
+	for(size_t m_i=0; m_i!=maps.size(); ++m_i){
+		auto& m = maps[m_i];
+		Engine::BlockBitmap& map = m.second;
+		int range = ranges[m_i];
+		if(m.first.empty()) continue;
+		std::srand(5);
+		std::vector<std::pair<int,int>> pairs;
+		int cells = map.width * map.height;
+		for(int tries=0; int(pairs.size()) != queries and tries != 100*queries; ++tries){
+			int a = std::rand() % cells, b = std::rand() % cells;
+			if(range){
+				int col = a % map.width + std::rand() % (2*range + 1) - range;
+				int row = a / map.width + std::rand() % (2*range + 1) - range;
+				if(col < 0 or row < 0 or col >= map.width or row >= map.height) continue;
+				b = col + row*map.width;
+			}
+			if(!map.Get(a % map.width, a / map.width) and !map.Get(b % map.width, b / map.width)) pairs.push_back(std::make_pair(a, b));
+		}
+		if(pairs.empty()){
+			std::cout << m.first << "\tno free cells, skipped" << std::endl;
+			continue;
+		}
+
+		for(int mode : {Engine::PATH_ASTAR, Engine::PATH_JPS, Engine::PATH_JPS_PLUS}){
+			Engine::Pathfinder finder;
+			finder.Init(map, true, Engine::PathMode(mode));
+			std::vector<int> path;
+			long expanded = 0, found = 0;
+			double t = Time([&]{
+				expanded = 0; found = 0;
+				for(auto& p : pairs){
+					found += finder.FindPath(p.first, p.second, path);
+					expanded += finder.expanded;
+				}
+			}, 3);
+			std::cout << m.first << (m.first.size() < 8 ? "\t\t" : "\t") << modes[mode] << "\t" << found << "\t"
+			          << expanded / long(pairs.size()) << "\t\t" << t / pairs.size() * 1e6 << "\t\t" << pairs.size() / t << std::endl;
+		}
+
+		// Hierarchical, cluster costs cached beforehand
+		Engine::PathHierarchy hierarchy;
+		std::vector<int> path;
+		hierarchy.Init(map);
+		double t_cache = Time([&]{ for(auto& c : hierarchy.clusters) c.dirty = true; hierarchy.FindPath(pairs[0].first, pairs[0].second, path); }, 1);
+		long expanded = 0, found = 0;
+		double t = Time([&]{
+			expanded = 0; found = 0;
+			for(auto& p : pairs){
+				found += hierarchy.FindPath(p.first, p.second, path);
+				expanded += hierarchy.expanded;
+			}
+		}, 3);
+		std::cout << m.first << (m.first.size() < 8 ? "\t\t" : "\t") << "HPA*\t" << found << "\t"
+		          << expanded / long(pairs.size()) << "\t\t" << t / pairs.size() * 1e6 << "\t\t" << pairs.size() / t
+		          << "\t(cache " << t_cache * 1e3 << " ms)" << std::endl;
+	}
+}
+
+void BenchFlow(){
+	const int agents = 10000;
+	std::cout << "== Flow field to one goal, 256x256" << std::endl;
+	std::cout << "map\t\tbuild ms\tns/agent lookup (" << agents << " agents)" << std::endl;
+
+	for(bool scattered : {true, false}){
+		Engine::BlockBitmap map;
+		PathMap(map, scattered);
+		int goal = 128*256 + 128;
+		map.Set(128, 128, false);
+
+		Engine::FlowField field;
+		std::vector<int> goals(1, goal);
+		double t_build = Time([&]{ field.Compute(map, goals); }, 3);
+
+		std::vector<int> cells(agents);
+		for(int& c : cells) c = std::rand() % (256*256);
+		long moving = 0;
+		double t_steer = Time([&]{
+			moving = 0;
+			int dx, dy;
+			for(int c : cells) moving += field.Direction(c, dx, dy);
+		});
+		std::cout << (scattered ? "scattered" : "open\t") << "\t" << t_build * 1e3 << "\t\t"
+		          << t_steer / agents * 1e9 << " (" << moving << " moving)" << std::endl;
+	}
+}
+
+void BenchFov(){
+	const int viewers = 300, ticks = 100;
+	std::cout << "== Field of view, " << viewers << " viewers walking on 256x256, " << ticks << " ticks" << std::endl;
+	std::cout << "map		radius	us/update	ms/tick	recomputed" << std::endl;
+
+	for(bool scattered : {true, false}){
+		Engine::BlockBitmap map;
+		PathMap(map, scattered);
+		for(int radius : {8, 16}){
+			std::srand(6);
+			std::vector<Engine::FieldOfView> fovs(viewers);
+			std::vector<int> cols(viewers), rows(viewers);
+			for(int v=0; v!=viewers; ++v){
+				do { cols[v] = std::rand() % 256; rows[v] = std::rand() % 256; } while(map.Get(cols[v], rows[v]));
+				fovs[v].Init(radius);
+			}
+			// Steps decided beforehand; half the viewers stand still each tick
+			std::vector<int> steps(size_t(viewers) * ticks);
+			for(int& s : steps) s = (std::rand() % 2) ? std::rand() % 9 : 4;
+			long recomputed = 0;
+			double t = Time([&]{
+				recomputed = 0;
+				for(int tick=0; tick!=ticks; ++tick){
+					for(int v=0; v!=viewers; ++v){
+						int s = steps[size_t(tick) * viewers + v];
+						int c = cols[v] + s % 3 - 1, r = rows[v] + s / 3 - 1;
+						if(c >= 0 and r >= 0 and c < 256 and r < 256 and !map.Get(c, r)){ cols[v] = c; rows[v] = r; }
+						recomputed += fovs[v].Update(map, cols[v], rows[v]);
+					}
+				}
+			}, 1);
+			std::cout << (scattered ? "scattered" : "open\t") << "\t" << radius << "\t" << t / (double(viewers) * ticks) * 1e6
+			          << "\t\t" << t / ticks * 1e3 << "\t" << recomputed << std::endl;
+		}
+	}
+}
+
+void BenchLight(){
+	const int torches = 200, ticks = 100;
+	std::cout << "== Tile light grid, " << torches << " torches on 256x256" << std::endl;
+	std::cout << "map\t\tmoving/tick\tms full build\tms/tick incremental" << std::endl;
+
+	for(bool scattered : {true, false}){
+		Engine::BlockBitmap map;
+		PathMap(map, scattered);
+		std::srand(7);
+		std::vector<int> cells(torches);
+		for(int& c : cells) c = std::rand() % (256*256);
+
+		double t_build = Time([&]{
+			Engine::LightGrid grid;
+			grid.Init(map, 24);
+			for(int c : cells) grid.Add(c, 255);
+		}, 3);
+
+		for(int moving : {1, 10, 50}){
+			Engine::LightGrid grid;
+			grid.Init(map, 24);
+			for(int c : cells) grid.Add(c, 255);
+			// Torches carried one tile at a time
+			double t = Time([&]{
+				for(int tick=0; tick!=ticks; ++tick){
+					for(int i=0; i!=moving; ++i){
+						int id = (tick * moving + i) % torches;
+						int cell = grid.lights[id].cell, step = std::rand() % 4;
+						int next = cell + (step == 0 ? 1 : step == 1 ? -1 : step == 2 ? 256 : -256);
+						if(next >= 0 and next < 256*256) grid.Move(id, next);
+					}
+					grid.dirty.clear(); // No GL context to upload to
+				}
+			}, 1);
+			std::cout << (scattered ? "scattered" : "open\t") << "\t" << moving << "\t\t" << t_build * 1e3
+			          << "\t\t" << t / ticks * 1e3 << std::endl;
+		}
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	std::string only = (argc > 1) ? argv[1] : "";
+	if(only.empty() or only == "pixels") BenchPixels();
+	if(only.empty() or only == "collision") BenchCollision();
+	if(only.empty() or only == "broadphase") BenchBroadphase();
+	if(only.empty() or only == "path") BenchPath();
+	if(only.empty() or only == "flow") BenchFlow();
+	if(only.empty() or only == "fov") BenchFov();
+	if(only.empty() or only == "light") BenchLight();
+	return 0;
+}
@@ -6,12 +6,19 @@
 #include <sstream>
 #include <cmath>
 #include <chrono>
+#include <algorithm>
+#include <memory>
 
 #include <GL/glew.h>
 #include <GL/glxew.h>
 #include <GLFW/glfw3.h>
 
 #include "Engine.h"
+#include "Collision.h"
+#include "Lighting.h"
+#include "Portal.h"
+#include "Loader.h"
+#include "Pack.h"
 
 //#define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -20,40 +27,15 @@
 #include "stb_image_write.h"
 
 
-bool IsValidMove(Engine::Tilemap &tmap, Engine::Shape &player, float &velx, float &vely){
+bool IsValidMove(Engine::Tilemap &tmap, Engine::WallMesh &walls, Engine::Shape &player, float &velx, float &vely){
 
-	bool xmove=true, ymove=true;
+	// Swept test: fast moves cannot skip over thin walls, and
+	// blocked moves slide along the wall instead of stopping.
+	// Walls are merged into rectangles, so few candidates are tested.
 	float vx=velx, vy=vely;
+	Engine::GridSlide(tmap, walls, Engine::AABB::FromVertices(&player.vertices[0]), velx, vely);
 
-	// x movement	
-	player.Move(velx, 0);	
-	for(int i=0; i!=tmap.height*tmap.width; ++i){
-		if(tmap.logic_grid[i] != Engine::TILE_WALL) continue;
-		// FIX THIS - GetTileVert method and shape.Collides accepts float array
-		std::vector<float> tile_vert(&tmap.shape.vertices[16*i], &tmap.shape.vertices[16*i]+16);
-		if(player.Collides(tile_vert)){
-			velx=0;
-			xmove = false;
-			break;
-		}
-	}
-	player.Move(-vx, 0);
-
-	// y movement
-	player.Move(0, vely);
-	for(int i=0; i!=tmap.height*tmap.width; ++i){
-		if(tmap.logic_grid[i] != Engine::TILE_WALL) continue;
-		// FIX THIS - GetTileVert method and shape.Collides accepts float array
-		std::vector<float> tile_vert(&tmap.shape.vertices[16*i], &tmap.shape.vertices[16*i]+16);
-		if(player.Collides(tile_vert)){
-			vely=0;
-			ymove = false;
-			break;
-		}
-	}
-	player.Move(0, -vy);
-
-	return (xmove and ymove);
+	return (velx == vx and vely == vy);
 }
 
 
@@ -61,6 +43,9 @@ int main()
 {
 
 	GLFWwindow *window = Engine::GLBegin(1280, 720);
+
+	// Optional, built with 'make res.pack'. Loose files are used otherwise.
+	Engine::ASSET_PACK.Open("res.pack");
 	
 	std::srand( std::time(nullptr) );
 	
@@ -73,19 +58,42 @@ int main()
 	std::string fshader("res/fragment.shader");
 	std::string player_tex("res/player.jpg");
 
-	Engine::Tilemap tilemap;
+	// Images are decoded on worker threads and uploaded through a context
+	// shared with the window, so level start does not freeze the window
+	Engine::TextureLoader loader;
+	loader.Init(0, window);
+
+	std::unique_ptr<Engine::Tilemap> tilemap(new Engine::Tilemap());
 	Engine::Shader shader;
 	Engine::Shape player;
 
-	tilemap.Init(tm, ts, side);
+	tilemap->Init(tm, ts, side, &loader);
+	Engine::BlockBitmap walls;
+	walls.Build(*tilemap, Engine::TILE_WALL);
+	Engine::WallMesh wall_mesh;
+	wall_mesh.Build(*tilemap, Engine::TILE_WALL);
+	Engine::LightGrid lights;
+	lights.Init(walls);
+	Engine::PortalSet portals;
+	portals.Init(*tilemap, 4, &loader);
 	shader.Init(vshader, fshader);
-	player.Init(player_tex, 50, 50);
+	player.Init(player_tex, 50, 50, &loader);
+
+	#ifdef DEBUG
+	Engine::TEXTURE_MEMORY.Report(std::cout);
+	#endif //DEBUG
 
 	shader.Bind();
 
+	// Lantern carried by the player
+	float cx, cy;
+	player.GetCenter(cx, cy);
+	int lantern = lights.Add(std::min<int>(tilemap->GetTile(cx, cy), tilemap->width*tilemap->height - 1), 255);
+
 	while( !glfwWindowShouldClose(window) ){
 
 		glClear(GL_COLOR_BUFFER_BIT);
+		loader.Update(2.0); // Swap in finished textures, at most 2 ms per frame
 
 		// Key states for player movement	
 		if(glfwGetKey(window, GLFW_KEY_W)==GLFW_PRESS) vely = 0.01f;
@@ -107,11 +115,29 @@ int main()
 			glfwSetWindowShouldClose(window, GLFW_TRUE);
 		}
 
-		IsValidMove(tilemap, player, velx, vely);
+		IsValidMove(*tilemap, wall_mesh, player, velx, vely);
 
 		// Drawing tilemap
-		tilemap.Move(-velx, -vely);
-		tilemap.Draw();
+		tilemap->Move(-velx, -vely);
+		GLuint player_tile = tilemap->GetTile(cx, cy);
+
+		// Destination maps are preloaded, entering one is a swap
+		std::unique_ptr<Engine::Tilemap> next = portals.Update(*tilemap, player_tile);
+		if(next){
+			tilemap.swap(next);
+			walls.Build(*tilemap, Engine::TILE_WALL);
+			wall_mesh.Build(*tilemap, Engine::TILE_WALL);
+			lights.Init(walls);
+			player_tile = tilemap->GetTile(cx, cy);
+			lantern = lights.Add(std::min<int>(player_tile, tilemap->width*tilemap->height - 1), 255);
+			portals.Init(*tilemap, 4, &loader);
+		}
+
+		if(player_tile < GLuint(tilemap->width*tilemap->height)) lights.Move(lantern, player_tile);
+		lights.ambient = 0.3f + 0.2f * std::sin(glfwGetTime() * 0.1); // Day/night
+		lights.Bind(*tilemap);
+		tilemap->Draw();
+		lights.Unbind(); // Only the map is lit
 	
 		// Drawing Player
 		player.Draw();
@@ -122,6 +148,7 @@ int main()
 		glfwPollEvents();
 	}
 
+	loader.Shutdown(); // Its threads and context go before GLFW
 	glfwTerminate();
 
 	return 0;
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+#include "Collision.h"
+#include "Vision.h"
+
+
+/*
+
+============== Engine checks ==============
+
+CPU-side regression checks, no window needed. Prints each failure and
+exits with the number of failed checks.
+
+	./tests
+
+*/
+
+
+static int FAILED = 0;
+
+#define CHECK(x) do {\
+		if(!(x)){\
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #x << std::endl;\
+			++FAILED;\
+		}\
+	} while(0)
+
+
+// Viewers at the edge and corners of the map must only see map cells
+void TestFovEdges(){
+	Engine::BlockBitmap walls;
+	walls.Init(10, 10);
+	int viewers[][2] = {{0, 0}, {9, 9}, {0, 9}, {9, 0}, {0, 5}, {5, 9}};
+	for(auto& v : viewers){
+		Engine::FieldOfView fov;
+		fov.Init(6);
+		fov.Compute(walls, v[0], v[1]);
+		CHECK(fov.Visible(v[0], v[1]));
+		CHECK(!fov.Visible(-1, -1));
+		CHECK(!fov.Visible(v[0] - 1, v[1]) or v[0] > 0);
+		CHECK(!fov.Visible(10, v[1]));
+		CHECK(!fov.Visible(v[0], 10));
+
+		int count = 0;
+		for(int r=0; r!=10; ++r)
+			for(int c=0; c!=10; ++c) count += fov.Visible(c, r);
+		CHECK(fov.Count() == count);
+
+		Engine::BlockBitmap seen;
+		seen.Init(10, 10);
+		fov.Reveal(seen);
+		CHECK(seen.Count(0, 0, 9, 9) == count);
+	}
+
+	// Corner of an open map: a quarter disc of radius 6
+	Engine::FieldOfView fov;
+	fov.Init(6);
+	fov.Compute(walls, 0, 0);
+	int quarter = 0;
+	for(int dy=0; dy<=6; ++dy)
+		for(int dx=0; dx<=6; ++dx) quarter += dx*dx + dy*dy <= 6*6 + 6;
+	CHECK(fov.Count() == quarter);
+
+	// Walking along the edge reports map cells only
+	fov.Update(walls, 1, 0);
+	for(int cell : fov.entered) CHECK(cell >= 0 and cell < 100);
+	for(int cell : fov.left) CHECK(cell >= 0 and cell < 100);
+}
+
+
+int main()
+{
+	TestFovEdges();
+	std::cout << (FAILED ? "FAILED " : "OK ") << FAILED << std::endl;
+	return FAILED;
+}
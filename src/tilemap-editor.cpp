@@ -15,6 +15,9 @@
 //#define DEBUG
 
 #include "Engine.h"
+#include "Collision.h"
+#include "Pathfinding.h"
+#include "Loader.h"
 
 //#define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -98,7 +101,7 @@ void TilemapCreate(std::string &ftmap, std::string &ftset, GLuint width, GLuint
 }
 
 
-bool ProcessInput(GLFWwindow* window, Engine::Shape &cursor, Engine::Tilemap &tmap, float &dx, float &dy){
+bool ProcessInput(GLFWwindow* window, Engine::Shape &cursor, Engine::Tilemap &tmap, Engine::WallMesh &walls, Engine::BlockBitmap &blocked, Engine::PathHierarchy &paths, float &dx, float &dy){
 	
 	// Movement	
 	if(glfwGetKey(window, GLFW_KEY_W)==GLFW_PRESS or glfwGetKey(window, GLFW_KEY_UP)==GLFW_PRESS) dy=0.01f;
@@ -145,6 +148,9 @@ bool ProcessInput(GLFWwindow* window, Engine::Shape &cursor, Engine::Tilemap &tm
 			if(tile_id != tmap.width*tmap.height and tmap.logic_grid[tile_id] != chosen_tile){
 				tmap.logic_grid[tile_id] = chosen_tile;
 				tmap.GenTileTextureCoords(tile_id);
+				walls.Update(tmap, tile_id);
+				blocked.Update(tmap, tile_id);
+				paths.Update(tile_id);
 			}
 		}
 		
@@ -160,6 +166,9 @@ bool ProcessInput(GLFWwindow* window, Engine::Shape &cursor, Engine::Tilemap &tm
 		if(spawn_found == false) std::cout <<"You must have a spawn tile before saving!"<<std::endl;
 		else{// Write to file
 			std::cout << " Saving tilemap..." << std::endl;
+			#ifdef DEBUG
+			std::cout << "[DEBUG] " << walls.rects.size() << " wall rectangles" << std::endl;
+			#endif
 			std::vector<GLuint> logic(tmap.logic_grid, tmap.logic_grid+tmap.width*tmap.height);
 			std::vector<GLuint> tiles(tmap.tile_grid, tmap.tile_grid+tmap.width*tmap.height);
 			if(!TilemapWrite(tmap.ftmap, logic, tiles, tmap.width, tmap.height)){
@@ -226,19 +235,31 @@ int main(int argc, char** argv)
 	shader.Init(vshader, fshader);
 	shader.Bind();
 
+	// Textures finish loading while the first frames are drawn
+	Engine::TextureLoader loader;
+	loader.Init(0, window);
+
 	// Tilemap
 	Engine::Tilemap tmap;
-	tmap.Init(ftilemap, ftileset, tileside);
+	tmap.Init(ftilemap, ftileset, tileside, &loader);
+	Engine::WallMesh walls;
+	walls.Build(tmap);
+	Engine::BlockBitmap blocked;
+	blocked.Build(tmap);
+	Engine::PathHierarchy paths;
+	paths.Init(blocked);
 
 	// Cursor
 	Engine::Shape shape;
-	shape.Init(ftileset, 100, 100);	
+	shape.Init(ftileset, 100, 100, &loader);	
+	shape.SetTileset(tmap.tileset);
 	shape.SetPosition(110, Engine::SCR_HEIGHT-110);
 	shape.SetTile(0);
 
 	while( !glfwWindowShouldClose(window) ){
 		glClear(GL_COLOR_BUFFER_BIT);
-		ProcessInput(window, shape, tmap, dx, dy);	
+		loader.Update(2.0);
+		ProcessInput(window, shape, tmap, walls, blocked, paths, dx, dy);	
 		
 		//Update
 		tmap.Move(-dx, -dy);
@@ -252,6 +273,7 @@ int main(int argc, char** argv)
 		glfwPollEvents();
 	}
 
+	loader.Shutdown(); // Its threads and context go before GLFW
 	glfwTerminate();
 	return 0;
 }